@@ -0,0 +1,7 @@
+#include "kcodec.h"
+
+//both sides start with CRC16, until set_block_check() picks the agreed one
+char codec_chkt = CHKT_CRC16;
+int codec_tlen = 3;
+
+pkg ctl_frames[4][MODULO_SEQ_EXT];
@@ -0,0 +1,297 @@
+#ifndef KCODEC
+#define KCODEC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lib.h"
+#include "klib.h"
+
+/*
+ * Packet codec shared by ksender and kreceiver. Packets are encoded directly
+ * into the payload of a caller-supplied msg and parsed in place, so building
+ * or reading a packet never allocates nor copies it. Its state, defined in
+ * kcodec.c, is one for the whole program.
+ */
+
+/*
+ * A packet parsed in place: data points inside the received msg
+ */
+typedef struct {
+	int seq;
+	char type;
+	unsigned char* data;
+	int len;
+} frame;
+
+/*
+ * Block check in use and the length of its trailer, check and mark. Both
+ * sides start with CRC16 and switch once the SEND-INIT exchange agreed on
+ * another one.
+ */
+extern char codec_chkt;
+extern int codec_tlen;
+
+//the ACK, NAK, EOF and EOT packets for every sequence number, sealed with
+//the block check in use
+#define CTL_ACK 0
+#define CTL_NAK 1
+#define CTL_EOF 2
+#define CTL_EOT 3
+extern pkg ctl_frames[4][MODULO_SEQ_EXT];
+
+/*
+ * Kermit type 1 checksum of the fields preceding hcheck in an extended header
+ */
+static inline unsigned char header_check(const header_x* h)
+{
+	int sum = h->len + h->seq + h->type + h->lenx1 + h->lenx2;
+	return (sum + ((sum & 0xc0) >> 6)) & 0x3f;
+}
+
+/*
+ * Where the data field of a packet starts; ext selects the extended header
+ */
+static inline unsigned char* packet_data(msg* m, int ext)
+{
+	return (unsigned char *) m->payload + (ext ? HX_LEN : H_LEN);
+}
+
+/*
+ * Longest data field a normal header can carry with block check chkt: its
+ * one-byte length also counts the check, so CRC32C leaves two bytes less
+ */
+static inline int short_maxl(char chkt)
+{
+	return 0xff + 2 - (int) H_LEN - CHECK_LEN(chkt) - 1;
+}
+
+/*
+ * Function that tells whether len data bytes checked with chkt need the
+ * extended header
+ */
+static inline int packet_ext(int len, char chkt)
+{
+	return len > short_maxl(chkt);
+}
+
+/*
+ * Block check of packet p: the SEND-INIT packet is always checked with
+ * CRC16, since the exchange it starts picks the block check
+ */
+static inline char packet_chkt(const unsigned char* p)
+{
+	return p[3] == TYPE_S ? CHKT_CRC16 : codec_chkt;
+}
+
+/*
+ * Function that computes the block check of type chkt over len bytes at p
+ * and stores it at out
+ */
+static inline void block_check(unsigned char* out, char chkt, const void* p,
+			       int len)
+{
+	if (chkt == CHKT_CRC32C) {
+		unsigned int check = crc32c(p, len);
+		memcpy(out, &check, sizeof(check));
+	} else {
+		unsigned short check = crc16_ccitt(p, len);
+		memcpy(out, &check, sizeof(check));
+	}
+}
+
+/*
+ * Function that completes a packet whose len data bytes were already written
+ * at packet_data(m, ext), checked with chkt: fills in the header, the check
+ * and the mark
+ */
+static inline void seal_check(msg* m, int seq, char type, int len, int ext,
+			      char chkt)
+{
+	header_x* h = (header_x *) m->payload;
+	int h_len = ext ? HX_LEN : H_LEN;
+	int t_len = CHECK_LEN(chkt) + 1;
+
+	h->soh = SOH;
+	h->seq = seq;
+	h->type = type;
+	if (ext) {
+		h->len = 0;
+		h->lenx1 = (len + t_len) >> 8;
+		h->lenx2 = (len + t_len) & 0xff;
+		h->hcheck = header_check(h);
+	} else {
+		h->len = h_len + len + t_len - 2;
+	}
+
+	unsigned char* t = (unsigned char *) m->payload + h_len + len;
+	block_check(t, chkt, m->payload, h_len + len);
+	t[t_len - 1] = MARK;
+
+	m->len = h_len + len + t_len;
+}
+
+/*
+ * Function that completes a packet with the block check in use
+ */
+static inline void seal_packet(msg* m, int seq, char type, int len, int ext)
+{
+	seal_check(m, seq, type, len, ext, codec_chkt);
+}
+
+/*
+ * Function that encodes a packet carrying a copy of data; the extended
+ * header is used only when the data does not fit a normal one
+ */
+static inline void encode_packet(msg* m, int seq, char type, const void* data,
+				 int len)
+{
+	int ext = packet_ext(len, codec_chkt);
+	memcpy(packet_data(m, ext), data, len);
+	seal_packet(m, seq, type, len, ext);
+}
+
+/*
+ * Function that encodes a SEND-INIT packet or its acknowledgement, both
+ * checked with CRC16
+ */
+static inline void encode_s(msg* m, int seq, char type, const s_data* d)
+{
+	memcpy(packet_data(m, 0), d, sizeof(s_data));
+	seal_check(m, seq, type, sizeof(s_data), 0, CHKT_CRC16);
+}
+
+/*
+ * Function that switches to block check chkt and seals the control packets
+ * with it; called with CHKT_CRC16 before the first packet
+ */
+static inline void set_block_check(char chkt)
+{
+	static const char types[4] = { TYPE_Y, TYPE_N, TYPE_Z, TYPE_B };
+	msg m;
+
+	codec_chkt = chkt == CHKT_CRC32C ? CHKT_CRC32C : CHKT_CRC16;
+	codec_tlen = CHECK_LEN(codec_chkt) + 1;
+	for (int i = 0; i < 4; ++i)
+		for (int seq = 0; seq < MODULO_SEQ_EXT; ++seq) {
+			seal_packet(&m, seq, types[i], 0, 0);
+			memcpy(&ctl_frames[i][seq], m.payload, m.len);
+		}
+}
+
+/*
+ * Function that copies one of the precomputed ACK, NAK, EOF or EOT packets
+ */
+static inline void encode_ctl(msg* m, int seq, char type)
+{
+	int i = type == TYPE_Y ? CTL_ACK : type == TYPE_N ? CTL_NAK :
+		type == TYPE_Z ? CTL_EOF : CTL_EOT;
+
+	memcpy(m->payload, &ctl_frames[i][seq & (MODULO_SEQ_EXT - 1)],
+	       H_LEN + codec_tlen);
+	m->len = H_LEN + codec_tlen;
+}
+
+/*
+ * Function that checks that the length declared in the header matches the
+ * number of bytes received and that the block check is correct
+ */
+static inline int check_packet(const msg* m)
+{
+	const unsigned char* p = (const unsigned char *) m->payload;
+
+	if (m->len < (int) H_LEN || m->len > (int) sizeof(m->payload))
+		return -1;
+	char chkt = packet_chkt(p);
+	int t_len = CHECK_LEN(chkt) + 1;
+	if (m->len < (int) H_LEN + t_len)
+		return -1;
+
+	if (p[1] != 0) {
+		if (p[1] + 2 != m->len)
+			return -1;
+	} else {
+		const header_x* h = (const header_x *) p;
+		if (m->len < (int) HX_LEN + t_len ||
+		    h->hcheck != header_check(h) ||
+		    (h->lenx1 << 8 | h->lenx2) + (int) HX_LEN != m->len)
+			return -1;
+	}
+
+	trailer t;
+	block_check(t.check, chkt, p, m->len - t_len);
+	return memcmp(t.check, p + m->len - t_len, t_len - 1) == 0 ? 0 : -1;
+}
+
+/*
+ * Function that parses a packet in place; check_packet() must have accepted
+ * it first
+ */
+static inline void parse_packet(msg* m, frame* f)
+{
+	unsigned char* p = (unsigned char *) m->payload;
+	int h_len = p[1] == 0 ? HX_LEN : H_LEN;
+
+	f->seq = p[2];
+	f->type = p[3];
+	f->data = p + h_len;
+	f->len = m->len - h_len - CHECK_LEN(packet_chkt(p)) - 1;
+}
+
+/*
+ * Function that reads the SEND-INIT parameters of a parsed packet; fields
+ * missing from a shorter packet are treated as zero
+ */
+static inline void parse_s(const frame* f, s_data* d)
+{
+	int len = f->len < (int) sizeof(s_data) ? f->len : (int) sizeof(s_data);
+
+	memset(d, 0, sizeof(s_data));
+	if (len > 0)
+		memcpy(d, f->data, len);
+}
+
+/*
+ * Function that returns the session id of SEND-INIT parameters
+ */
+static inline unsigned int s_session(const s_data* d)
+{
+	return (unsigned int) d->sid[0] << 24 | d->sid[1] << 16 |
+	       d->sid[2] << 8 | d->sid[3];
+}
+
+/*
+ * Function that appends an attribute (tag, length, decimal value) at p.
+ * Returns the number of bytes written.
+ */
+static inline int attr_put(unsigned char* p, char tag, long long value)
+{
+	char digits[24];
+	int n = snprintf(digits, sizeof(digits), "%lld", value);
+
+	p[0] = tag;
+	p[1] = n;
+	memcpy(p + 2, digits, n);
+	return n + 2;
+}
+
+/*
+ * Function that looks an attribute up in the data of a packet. Returns its
+ * value, or -1 if the packet does not carry it.
+ */
+static inline long long attr_get(const frame* f, char tag)
+{
+	for (int i = 0; i + 2 <= f->len; i += 2 + f->data[i + 1]) {
+		int len = f->data[i + 1];
+		if (f->data[i] != tag || i + 2 + len > f->len || len >= 24)
+			continue;
+
+		char value[24];
+		memcpy(value, f->data + i + 2, len);
+		value[len] = '\0';
+		return atoll(value);
+	}
+	return -1;
+}
+
+#endif
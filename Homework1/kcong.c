@@ -0,0 +1,93 @@
+#include "kcong.h"
+#include "kstats.h"
+
+static void cong_record(const congestion* c)
+{
+	stats.cwnd = c->cwnd;
+	stats.ssthresh = c->ssthresh;
+	stats_record(&stats.cwnd_packets, c->cwnd);
+}
+
+/*
+ * Function that starts the window of a transfer allowed max packets in
+ * flight by the receiver
+ */
+void cong_init(congestion* c, int mode, int max)
+{
+	c->mode = mode;
+	c->max = max;
+	c->cwnd = mode == CONG_OFF || max < CONG_INITIAL ? max : CONG_INITIAL;
+	c->ssthresh = max;
+	c->acked = 0;
+	c->recover = 0;
+	c->base_rtt = 0;
+	cong_record(c);
+}
+
+/*
+ * Number of packets that may be in flight now
+ */
+int cong_window(const congestion* c)
+{
+	return c->cwnd;
+}
+
+/*
+ * Function that grows the window for a packet acknowledged; sample is its
+ * round trip if it was sent once, 0 otherwise
+ */
+void cong_ack(congestion* c, long long srtt, long long sample)
+{
+	if (c->mode == CONG_OFF)
+		return;
+	if (sample > 0 && (c->base_rtt == 0 || sample < c->base_rtt))
+		c->base_rtt = sample;
+
+	int grow = 1;
+	if (c->mode == CONG_DELAY && c->base_rtt > 0 && srtt > c->base_rtt) {
+		long long queued = c->cwnd * (srtt - c->base_rtt) / srtt;
+		if (queued >= CONG_ALPHA) {
+			//the queue is building up: slow start is over
+			grow = 0;
+			if (c->ssthresh > c->cwnd)
+				c->ssthresh = c->cwnd;
+			if (queued > CONG_BETA && ++c->acked >= c->cwnd) {
+				c->acked = 0;
+				if (c->cwnd > CONG_MIN)
+					c->cwnd--;
+				c->ssthresh = c->cwnd;
+			}
+		}
+	}
+
+	if (grow) {
+		if (c->cwnd < c->ssthresh) {
+			c->cwnd++;
+		} else if (++c->acked >= c->cwnd) {
+			c->acked = 0;
+			c->cwnd++;
+		}
+	}
+	if (c->cwnd > c->max)
+		c->cwnd = c->max;
+	cong_record(c);
+}
+
+/*
+ * Function that halves the window when packet abs timed out, unless it was
+ * sent before the last cut; next is the number of the next packet
+ */
+void cong_timeout(congestion* c, unsigned int abs, unsigned int next)
+{
+	if (c->mode == CONG_OFF || abs < c->recover)
+		return;
+
+	c->ssthresh = c->cwnd / 2 > CONG_MIN ? c->cwnd / 2 : CONG_MIN;
+	if (c->ssthresh > c->max)
+		c->ssthresh = c->max;
+	c->cwnd = c->ssthresh;
+	c->acked = 0;
+	c->recover = next;
+	stats.cwnd_cuts++;
+	cong_record(c);
+}
@@ -0,0 +1,41 @@
+#ifndef KCONG
+#define KCONG
+
+/*
+ * Congestion control of the sender's window. The window starts small and
+ * doubles every round trip (slow start) until ssthresh, then grows by one
+ * packet per round trip; a timeout halves it, once per window of packets.
+ * NAKs are left alone: on the emulated link they tell of random loss and
+ * corruption, while the queue in front of the link shows up as delay. The
+ * delay mode also estimates how many packets wait in that queue from the
+ * inflation of the smoothed RTT over the lowest one seen, and stops growing
+ * past CONG_ALPHA of them and shrinks past CONG_BETA.
+ */
+
+#define CONG_OFF 0
+#define CONG_AIMD 1
+#define CONG_DELAY 2
+
+#define CONG_INITIAL 4
+#define CONG_MIN 2
+#define CONG_ALPHA 2
+#define CONG_BETA 4
+
+typedef struct {
+	int mode;
+	//window in packets, slow start threshold and the negotiated window
+	int cwnd, ssthresh, max;
+	//acknowledgements counted towards the next change of a round
+	int acked;
+	//packets numbered below recover were sent before the last cut
+	unsigned int recover;
+	//lowest RTT sample, in microseconds
+	long long base_rtt;
+} congestion;
+
+void cong_init(congestion* c, int mode, int max);
+int cong_window(const congestion* c);
+void cong_ack(congestion* c, long long srtt, long long sample);
+void cong_timeout(congestion* c, unsigned int abs, unsigned int next);
+
+#endif
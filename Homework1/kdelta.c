@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include "kdelta.h"
+
+/*
+ * The weak checksum of a window x[0..len) is a | b << 16, with a the sum of
+ * its bytes and b the sum of (len - i) * x[i], both modulo 2^16. The strong
+ * one runs STRONG_LANES independent 32-bit multiply-rotate lanes over
+ * 32-byte stripes, so a vector unit hashes a whole stripe per step, and
+ * folds the lanes and the tail into 64 bits.
+ */
+
+#define STRONG_LANES 8
+#define STRONG_STRIPE 32
+#define STRONG_P1 2654435761U
+#define STRONG_P2 2246822519U
+#define STRONG_P64 0x9e3779b97f4a7c15ULL
+
+static unsigned int weak_scalar(const unsigned char* p, int len)
+{
+	unsigned int a = 0, b = 0;
+
+	for (int i = 0; i < len; ++i) {
+		a += p[i];
+		b += a;
+	}
+	return (a & 0xffff) | b << 16;
+}
+
+static void strong_scalar(unsigned int* h, const unsigned char* p, int stripes)
+{
+	for (int s = 0; s < stripes; ++s, p += STRONG_STRIPE)
+		for (int i = 0; i < STRONG_LANES; ++i) {
+			unsigned int x;
+			memcpy(&x, p + 4 * i, sizeof(x));
+			h[i] += x * STRONG_P2;
+			h[i] = (h[i] << 13 | h[i] >> 19) * STRONG_P1;
+		}
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline unsigned int sum_lanes(const __m256i* v)
+{
+	unsigned int lane[8], sum = 0;
+
+	_mm256_storeu_si256((__m256i *) lane, *v);
+	for (int i = 0; i < 8; ++i)
+		sum += lane[i];
+	return sum;
+}
+
+/*
+ * Weak checksum 32 bytes per step: the byte sums come from psadbw, the
+ * weighted sums of a stripe from pmaddubsw with weights 32..1, and every
+ * stripe adds 32 times the sum of the bytes before it to b
+ */
+__attribute__((target("avx2")))
+static unsigned int weak_avx2(const unsigned char* p, int len)
+{
+	const __m256i weights = _mm256_set_epi8(1, 2, 3, 4, 5, 6, 7, 8,
+						9, 10, 11, 12, 13, 14, 15, 16,
+						17, 18, 19, 20, 21, 22, 23, 24,
+						25, 26, 27, 28, 29, 30, 31, 32);
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i va = zero, vprev = zero, vb = zero;
+	int n = len / 32;
+
+	for (int s = 0; s < n; ++s) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) (p + 32 * s));
+		vprev = _mm256_add_epi32(vprev, va);
+		va = _mm256_add_epi32(va, _mm256_sad_epu8(x, zero));
+		vb = _mm256_add_epi32(vb, _mm256_madd_epi16(
+				      _mm256_maddubs_epi16(x, weights), ones));
+	}
+
+	unsigned int a = sum_lanes(&va);
+	unsigned int b = 32 * sum_lanes(&vprev) + sum_lanes(&vb);
+	for (int i = 32 * n; i < len; ++i) {
+		a += p[i];
+		b += a;
+	}
+	return (a & 0xffff) | b << 16;
+}
+
+__attribute__((target("avx2")))
+static void strong_avx2(unsigned int* h, const unsigned char* p, int stripes)
+{
+	const __m256i p1 = _mm256_set1_epi32(STRONG_P1);
+	const __m256i p2 = _mm256_set1_epi32(STRONG_P2);
+	__m256i v = _mm256_loadu_si256((const __m256i *) h);
+
+	for (int s = 0; s < stripes; ++s, p += STRONG_STRIPE) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) p);
+		v = _mm256_add_epi32(v, _mm256_mullo_epi32(x, p2));
+		v = _mm256_or_si256(_mm256_slli_epi32(v, 13),
+				    _mm256_srli_epi32(v, 19));
+		v = _mm256_mullo_epi32(v, p1);
+	}
+	_mm256_storeu_si256((__m256i *) h, v);
+}
+#endif
+
+static unsigned int (*weak_kernel)(const unsigned char*, int) = weak_scalar;
+static void (*strong_kernel)(unsigned int*, const unsigned char*, int) =
+	strong_scalar;
+
+/*
+ * Picks the vector kernels if the CPU supports them
+ */
+__attribute__((constructor))
+static void delta_init()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		weak_kernel = weak_avx2;
+		strong_kernel = strong_avx2;
+	}
+#endif
+}
+
+unsigned int delta_weak(const unsigned char* p, int len)
+{
+	return weak_kernel(p, len);
+}
+
+unsigned long long delta_strong(const unsigned char* p, int len)
+{
+	unsigned int h[STRONG_LANES];
+	int stripes = len / STRONG_STRIPE;
+
+	for (int i = 0; i < STRONG_LANES; ++i)
+		h[i] = (i + 1) * STRONG_P2;
+	strong_kernel(h, p, stripes);
+
+	unsigned long long r = len * STRONG_P64;
+	for (int i = 0; i < STRONG_LANES; ++i) {
+		r = (r ^ h[i]) * STRONG_P64;
+		r ^= r >> 32;
+	}
+	for (int i = stripes * STRONG_STRIPE; i < len; ++i)
+		r = (r ^ p[i]) * STRONG_P64;
+
+	r ^= r >> 33;
+	r *= 0xff51afd7ed558ccdULL;
+	r ^= r >> 33;
+	r *= 0xc4ceb9fe1a85ec53ULL;
+	return r ^ r >> 33;
+}
+
+/*
+ * Function that picks the block size for an old copy of size bytes, about
+ * its square root so that signatures and literals cost alike
+ */
+int delta_block_size(long long size)
+{
+	int block = DELTA_MIN_BLOCK;
+	while (block < DELTA_MAX_BLOCK && (long long) block * block < size)
+		block <<= 1;
+	return block;
+}
+
+/*
+ * Function that writes to out the signatures of count blocks of fd starting
+ * with block index. Returns the number of blocks the file holds in full.
+ */
+int delta_signatures(int fd, int block, int index, int count,
+		     unsigned char* out)
+{
+	static unsigned char buf[DELTA_MAX_BLOCK];
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		off_t offset = (off_t) (index + i) * block;
+		int done = 0;
+		while (done < block) {
+			int n = pread(fd, buf + done, block - done,
+				      offset + done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			done += n;
+		}
+		if (done < block)
+			break;
+
+		unsigned int weak = delta_weak(buf, block);
+		unsigned long long strong = delta_strong(buf, block);
+		memcpy(out + DELTA_SIG * i, &weak, sizeof(weak));
+		memcpy(out + DELTA_SIG * i + sizeof(weak), &strong,
+		       sizeof(strong));
+	}
+	return i;
+}
+
+/*
+ * Function that stores the signatures of a reply, the first of which
+ * belongs to block index
+ */
+void delta_parse(delta_index* x, int index, const unsigned char* data,
+		 int len)
+{
+	for (int i = 0; i < len / DELTA_SIG && index + i < x->nblocks; ++i) {
+		delta_sig* s = &x->sig[index + i];
+		memcpy(&s->weak, data + DELTA_SIG * i, sizeof(s->weak));
+		memcpy(&s->strong, data + DELTA_SIG * i + sizeof(s->weak),
+		       sizeof(s->strong));
+		s->valid = 1;
+	}
+}
+
+/*
+ * Function that prepares room for the signatures of nblocks blocks.
+ * Returns -1 if there is not enough memory.
+ */
+int delta_index_open(delta_index* x, int block, int nblocks)
+{
+	x->block = block;
+	x->nblocks = nblocks;
+	x->bits = 1;
+	while ((1 << x->bits) < 2 * nblocks)
+		x->bits++;
+
+	x->sig = calloc(nblocks, sizeof(delta_sig));
+	x->chain = malloc(nblocks * sizeof(int));
+	x->bucket = malloc((1 << x->bits) * sizeof(int));
+	if (x->sig == NULL || x->chain == NULL || x->bucket == NULL) {
+		delta_index_close(x);
+		return -1;
+	}
+	return 0;
+}
+
+static unsigned int delta_hash(const delta_index* x, unsigned int weak)
+{
+	return (weak * STRONG_P1) >> (32 - x->bits);
+}
+
+/*
+ * Function that hashes the signatures received, earlier blocks first in
+ * every chain
+ */
+void delta_index_build(delta_index* x)
+{
+	memset(x->bucket, 0xff, (1 << x->bits) * sizeof(int));
+	for (int i = x->nblocks - 1; i >= 0; --i) {
+		if (!x->sig[i].valid)
+			continue;
+		unsigned int h = delta_hash(x, x->sig[i].weak);
+		x->chain[i] = x->bucket[h];
+		x->bucket[h] = i;
+	}
+}
+
+/*
+ * Function that looks up the block of the old copy equal to the window at
+ * p, whose weak checksum is weak. hint is tried first, so that runs of
+ * consecutive blocks stay together. Returns -1 if no block matches.
+ */
+int delta_index_find(const delta_index* x, unsigned int weak,
+		     const unsigned char* p, int hint)
+{
+	unsigned long long strong = 0;
+	int hashed = 0;
+
+	if (hint >= 0 && hint < x->nblocks && x->sig[hint].valid &&
+	    x->sig[hint].weak == weak) {
+		strong = delta_strong(p, x->block);
+		hashed = 1;
+		if (strong == x->sig[hint].strong)
+			return hint;
+	}
+
+	for (int i = x->bucket[delta_hash(x, weak)]; i >= 0; i = x->chain[i]) {
+		if (x->sig[i].weak != weak)
+			continue;
+		if (!hashed) {
+			strong = delta_strong(p, x->block);
+			hashed = 1;
+		}
+		if (strong == x->sig[i].strong)
+			return i;
+	}
+	return -1;
+}
+
+void delta_index_close(delta_index* x)
+{
+	free(x->sig);
+	free(x->chain);
+	free(x->bucket);
+	x->sig = NULL;
+	x->chain = x->bucket = NULL;
+}
@@ -0,0 +1,70 @@
+#ifndef KDELTA
+#define KDELTA
+
+/*
+ * Block signatures for delta transfers, in the manner of rsync. The receiver
+ * splits its old copy of a file into blocks and sends a weak and a strong
+ * checksum of each; the sender slides a window over the new file, rolling
+ * the weak checksum one byte at a time, and replaces every window whose
+ * checksums match a block with a reference to that block.
+ */
+
+//weak and strong checksum of one block as carried in a reply
+#define DELTA_SIG 12
+
+//block sizes grow with the square root of the file
+#define DELTA_MIN_BLOCK 512
+#define DELTA_MAX_BLOCK (1 << 16)
+
+//a copy is the repeat prefix and a zero count followed by DELTA_COPY bytes:
+//the 4-byte index of the first block and the number of consecutive blocks
+#define DELTA_COPY 5
+#define DELTA_RUN_MAX 0xff
+
+//bytes the sender scans without a match before sending them as literals
+#define DELTA_SCAN (1 << 16)
+
+typedef struct {
+	unsigned int weak;
+	unsigned long long strong;
+	int valid;
+} delta_sig;
+
+/*
+ * Signatures of the old copy, hashed by weak checksum; chain links the
+ * blocks that share a bucket
+ */
+typedef struct {
+	int block, nblocks;
+	delta_sig* sig;
+	int* bucket;
+	int* chain;
+	int bits;
+} delta_index;
+
+unsigned int delta_weak(const unsigned char* p, int len);
+unsigned long long delta_strong(const unsigned char* p, int len);
+int delta_block_size(long long size);
+int delta_signatures(int fd, int block, int index, int count,
+		     unsigned char* out);
+void delta_parse(delta_index* x, int index, const unsigned char* data,
+		 int len);
+int delta_index_open(delta_index* x, int block, int nblocks);
+void delta_index_build(delta_index* x);
+int delta_index_find(const delta_index* x, unsigned int weak,
+		     const unsigned char* p, int hint);
+void delta_index_close(delta_index* x);
+
+/*
+ * Function that slides the weak checksum of a len-byte window one byte
+ * forward: out leaves the window and in enters it
+ */
+static inline unsigned int delta_roll(unsigned int weak, unsigned char out,
+				      unsigned char in, int len)
+{
+	unsigned int a = (weak & 0xffff) - out + in;
+	unsigned int b = (weak >> 16) - len * out + a;
+	return (a & 0xffff) | b << 16;
+}
+
+#endif
@@ -0,0 +1,187 @@
+#include <string.h>
+#include "kfec.h"
+
+//GF(256) with the polynomial x^8 + x^4 + x^3 + x^2 + 1
+#define GF_POLY 0x11d
+
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+static unsigned char gf_mul[256][256];
+static unsigned char coef[FEC_MAX_K][FEC_MAX_N];
+
+static unsigned char gf_inv(unsigned char a)
+{
+	return gf_exp[255 - gf_log[a]];
+}
+
+/*
+ * Builds the field tables and the coding matrix before main runs: row j,
+ * column i of the Cauchy matrix is 1 / (j + FEC_MAX_K + i), every column
+ * being divided by its first row so that parity 0 is the xor of the block
+ */
+__attribute__((constructor))
+static void fec_init()
+{
+	int x = 1;
+	for (int i = 0; i < 255; ++i) {
+		gf_exp[i] = gf_exp[i + 255] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= GF_POLY;
+	}
+
+	for (int a = 1; a < 256; ++a)
+		for (int b = 1; b < 256; ++b)
+			gf_mul[a][b] = gf_exp[gf_log[a] + gf_log[b]];
+
+	for (int i = 0; i < FEC_MAX_N; ++i) {
+		unsigned char first = gf_inv(0 ^ (FEC_MAX_K + i));
+		for (int j = 0; j < FEC_MAX_K; ++j)
+			coef[j][i] = gf_mul[gf_inv(j ^ (FEC_MAX_K + i))]
+					   [gf_inv(first)];
+	}
+}
+
+unsigned char fec_coef(int j, int i)
+{
+	return coef[j][i];
+}
+
+/*
+ * dst += c * src over len bytes
+ */
+void fec_muladd(unsigned char* dst, const unsigned char* src, unsigned char c,
+		int len)
+{
+	if (c == 0)
+		return;
+	if (c == 1) {
+		for (int i = 0; i < len; ++i)
+			dst[i] ^= src[i];
+		return;
+	}
+
+	const unsigned char* row = gf_mul[c];
+	for (int i = 0; i < len; ++i)
+		dst[i] ^= row[src[i]];
+}
+
+/*
+ * Function that starts the parity of a new block
+ */
+void fec_reset(fec_encoder* e, unsigned int start, int k, int len)
+{
+	e->start = start;
+	e->n = 0;
+	e->k = k;
+	e->len = len;
+	for (int j = 0; j < k; ++j)
+		memset(e->parity[j], 0, len);
+}
+
+/*
+ * Function that adds the next packet of the block to its parity
+ */
+void fec_add(fec_encoder* e, char type, const unsigned char* data, int len)
+{
+	unsigned char head[FEC_HEADER] = { type, len >> 8, len & 0xff };
+
+	for (int j = 0; j < e->k; ++j) {
+		unsigned char c = coef[j][e->n];
+		fec_muladd(e->parity[j], head, c, FEC_HEADER);
+		fec_muladd(e->parity[j] + FEC_HEADER, data, c, len);
+	}
+	e->n++;
+}
+
+/*
+ * Function that inverts the m x m matrix a in place by Gauss-Jordan
+ * elimination. Returns -1 if it is singular.
+ */
+static int gf_invert(unsigned char a[FEC_MAX_K][FEC_MAX_K], int m)
+{
+	unsigned char inv[FEC_MAX_K][FEC_MAX_K];
+	memset(inv, 0, sizeof(inv));
+	for (int i = 0; i < m; ++i)
+		inv[i][i] = 1;
+
+	for (int c = 0; c < m; ++c) {
+		int p = c;
+		while (p < m && a[p][c] == 0)
+			p++;
+		if (p == m)
+			return -1;
+		for (int i = 0; i < m; ++i) {
+			unsigned char t = a[c][i]; a[c][i] = a[p][i]; a[p][i] = t;
+			t = inv[c][i]; inv[c][i] = inv[p][i]; inv[p][i] = t;
+		}
+
+		unsigned char s = gf_inv(a[c][c]);
+		for (int i = 0; i < m; ++i) {
+			a[c][i] = gf_mul[s][a[c][i]];
+			inv[c][i] = gf_mul[s][inv[c][i]];
+		}
+
+		for (int r = 0; r < m; ++r) {
+			unsigned char f = a[r][c];
+			if (r == c || f == 0)
+				continue;
+			for (int i = 0; i < m; ++i) {
+				a[r][i] ^= gf_mul[f][a[c][i]];
+				inv[r][i] ^= gf_mul[f][inv[c][i]];
+			}
+		}
+	}
+
+	memcpy(a, inv, sizeof(inv));
+	return 0;
+}
+
+/*
+ * Function that rebuilds the lost symbols of a block of n packets. sym[i]
+ * holds the first sym_len[i] bytes of symbol i (the rest being zero) or is
+ * NULL if the packet was lost; parity[t] is parity symbol rows[t]. Every
+ * lost symbol is written, len bytes long, to out[i].
+ * Returns the number of symbols rebuilt, or -1 if too many were lost.
+ */
+int fec_recover(int n, unsigned char* const* sym, const int* sym_len,
+		int nrows, const int* rows, unsigned char* const* parity,
+		int len, unsigned char* const* out)
+{
+	static unsigned char rest[FEC_MAX_K][FEC_SYMBOL];
+	unsigned char a[FEC_MAX_K][FEC_MAX_K];
+	int lost[FEC_MAX_K];
+	int m = 0;
+
+	for (int i = 0; i < n; ++i) {
+		if (sym[i] != NULL)
+			continue;
+		if (m == nrows || m == FEC_MAX_K)
+			return -1;
+		lost[m++] = i;
+	}
+	if (m == 0)
+		return 0;
+
+	//what the lost symbols add up to in the first m parity symbols
+	for (int t = 0; t < m; ++t) {
+		memcpy(rest[t], parity[t], len);
+		for (int i = 0; i < n; ++i)
+			if (sym[i] != NULL)
+				fec_muladd(rest[t], sym[i], coef[rows[t]][i],
+					   sym_len[i] < len ? sym_len[i] : len);
+		for (int u = 0; u < m; ++u)
+			a[t][u] = coef[rows[t]][lost[u]];
+	}
+
+	if (gf_invert(a, m) < 0)
+		return -1;
+
+	for (int u = 0; u < m; ++u) {
+		memset(out[lost[u]], 0, len);
+		for (int t = 0; t < m; ++t)
+			fec_muladd(out[lost[u]], rest[t], a[u][t], len);
+	}
+	return m;
+}
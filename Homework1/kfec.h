@@ -0,0 +1,39 @@
+#ifndef KFEC
+#define KFEC
+
+#include "klib.h"
+
+/*
+ * Forward error correction over blocks of window packets. Every packet of a
+ * block is taken as a symbol made of its type, its 2-byte data length and
+ * its data, zero padded to the longest data the sender may use. Parity
+ * symbol j is sum(g[j][i] * symbol i) over GF(256), g being a Cauchy matrix
+ * whose first row was scaled to ones: one parity packet is a plain XOR, and
+ * any k parity packets rebuild any k lost packets of the block.
+ */
+
+#define FEC_MAX_N 64
+#define FEC_MAX_K 8
+#define FEC_HEADER 3
+#define FEC_SYMBOL (MAXLX + FEC_HEADER)
+
+/*
+ * Parity being accumulated for the block that starts at packet start, of
+ * which n packets were added so far; len is the symbol length
+ */
+typedef struct {
+	unsigned int start;
+	int n, k, len;
+	unsigned char parity[FEC_MAX_K][FEC_SYMBOL];
+} fec_encoder;
+
+unsigned char fec_coef(int j, int i);
+void fec_muladd(unsigned char* dst, const unsigned char* src, unsigned char c,
+		int len);
+void fec_reset(fec_encoder* e, unsigned int start, int k, int len);
+void fec_add(fec_encoder* e, char type, const unsigned char* data, int len);
+int fec_recover(int n, unsigned char* const* sym, const int* sym_len,
+		int nrows, const int* rows, unsigned char* const* parity,
+		int len, unsigned char* const* out);
+
+#endif
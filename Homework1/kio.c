@@ -0,0 +1,645 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include "lib.h"
+#include "klib.h"
+#include "kio.h"
+
+/*
+ * Function that opens the next file of an archive and queues its header and
+ * name; files that cannot be read are left out. After the last file the
+ * header that ends the archive is queued. Returns 0 once that was produced.
+ */
+static int pack_next(reader* r)
+{
+	archive_header h;
+
+	while (r->file < r->nfiles) {
+		const char* name = r->files[r->file++];
+		int fd = open(name, O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+		    strlen(name) > ARCHIVE_NAME_MAX) {
+			printf("=== File %s left out of the archive ===\n", name);
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+
+		h.name_len = strlen(name);
+		h.mode = st.st_mode & 07777;
+		h.size = st.st_size;
+		memcpy(r->header, &h, sizeof(h));
+		memcpy(r->header + sizeof(h), name, h.name_len);
+		r->header_len = sizeof(h) + h.name_len;
+		r->header_pos = 0;
+		r->remaining = st.st_size;
+		r->fd = fd;
+		return 1;
+	}
+
+	if (r->file++ > r->nfiles)
+		return 0;
+	memset(&h, 0, sizeof(h));
+	memcpy(r->header, &h, sizeof(h));
+	r->header_len = sizeof(h);
+	r->header_pos = 0;
+	return 1;
+}
+
+/*
+ * Function that produces the next bytes of the archive of the files the
+ * reader was opened on: each file is its header, its name and exactly the
+ * size the header announces, zero padded if the file shrank meanwhile.
+ * Returns 0 at the end of the archive.
+ */
+static int pack_files(reader* r, unsigned char* buf, int room)
+{
+	while (r->header_pos == r->header_len && r->remaining == 0) {
+		if (r->fd >= 0)
+			close(r->fd);
+		r->fd = -1;
+		if (!pack_next(r))
+			return 0;
+	}
+
+	if (r->header_pos < r->header_len) {
+		int n = r->header_len - r->header_pos < room ?
+			r->header_len - r->header_pos : room;
+		memcpy(buf, r->header + r->header_pos, n);
+		r->header_pos += n;
+		return n;
+	}
+
+	int want = r->remaining < room ? r->remaining : room;
+	int n = read(r->fd, buf, want);
+	if (n < 0 && errno == EINTR)
+		return -1;
+	if (n <= 0) {
+		memset(buf, 0, want);
+		n = want;
+	}
+	r->remaining -= n;
+	return n;
+}
+
+/*
+ * Prefetch thread: fills the free chunks of the ring until end of input or
+ * until the reader is closed
+ */
+static void* reader_run(void* arg)
+{
+	reader* r = arg;
+
+	pthread_mutex_lock(&r->lock);
+	while (1) {
+		while (r->count == KIO_RING && !r->stop)
+			pthread_cond_wait(&r->drained, &r->lock);
+		if (r->stop)
+			break;
+
+		kio_chunk* c = &r->ring[r->tail];
+		c->len = 0;
+		c->eof = 0;
+		pthread_mutex_unlock(&r->lock);
+
+		while (c->len < KIO_CHUNK) {
+			int n = r->files != NULL ?
+				pack_files(r, c->data + c->len,
+					   KIO_CHUNK - c->len) :
+				read(r->fd, c->data + c->len,
+				     KIO_CHUNK - c->len);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				c->eof = 1;
+				break;
+			}
+			c->len += n;
+
+			//do not hold back data the consumer is waiting for
+			pthread_mutex_lock(&r->lock);
+			int waiting = r->waiting;
+			pthread_mutex_unlock(&r->lock);
+			if (waiting)
+				break;
+		}
+
+		pthread_mutex_lock(&r->lock);
+		r->tail = (r->tail + 1) % KIO_RING;
+		r->count++;
+		pthread_cond_signal(&r->filled);
+		if (r->waiting) {
+			unsigned long long one = 1;
+			write(r->ready_fd, &one, sizeof(one));
+		}
+		if (c->eof)
+			break;
+	}
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+/*
+ * Function that allocates the ring and starts the prefetch thread
+ */
+static int reader_start(reader* r)
+{
+	for (int i = 0; i < KIO_RING; ++i)
+		r->ring[i].data = malloc(KIO_CHUNK);
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->filled, NULL);
+	pthread_cond_init(&r->drained, NULL);
+	r->ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return pthread_create(&r->thread, NULL, reader_run, r) == 0 ? 0 : -1;
+}
+
+/*
+ * Function that starts prefetching fd. Returns -1 if fd is not valid.
+ */
+int reader_open(reader* r, int fd)
+{
+	r->fd = fd;
+	r->buffer = NULL;
+	r->pos = r->len = 0;
+	r->eof = 0;
+	r->head = r->tail = r->count = 0;
+	r->waiting = r->stop = 0;
+	r->files = NULL;
+	r->header = NULL;
+	if (fd < 0)
+		return -1;
+	return reader_start(r);
+}
+
+/*
+ * Function that starts producing the archive of n files; the thread opens
+ * and closes them as it goes. Returns -1 if the thread cannot be started.
+ */
+int reader_open_files(reader* r, char* const* files, int n)
+{
+	r->fd = -1;
+	r->buffer = NULL;
+	r->pos = r->len = 0;
+	r->eof = 0;
+	r->head = r->tail = r->count = 0;
+	r->waiting = r->stop = 0;
+	r->files = files;
+	r->nfiles = n;
+	r->file = 0;
+	r->remaining = 0;
+	r->header_len = r->header_pos = 0;
+	r->header = malloc(sizeof(archive_header) + ARCHIVE_NAME_MAX);
+	return reader_start(r);
+}
+
+/*
+ * Function that tells whether reader_avail() can return without blocking.
+ * If it cannot, the thread publishes what it holds as soon as it can and
+ * signals ready_fd.
+ */
+int reader_ready(reader* r)
+{
+	if (r->pos < r->len || r->eof)
+		return 1;
+
+	pthread_mutex_lock(&r->lock);
+	//the chunk being consumed still counts until it is handed back
+	int ready = r->count > (r->buffer != NULL);
+	if (!ready)
+		r->waiting = 1;
+	pthread_mutex_unlock(&r->lock);
+	return ready;
+}
+
+/*
+ * Number of prefetched bytes not yet consumed, moving on to the next chunk
+ * if the current one is used up. Returns 0 only at end of input.
+ */
+int reader_avail(reader* r)
+{
+	while (r->pos == r->len && !r->eof) {
+		pthread_mutex_lock(&r->lock);
+		if (r->buffer != NULL) {
+			r->head = (r->head + 1) % KIO_RING;
+			r->count--;
+			pthread_cond_signal(&r->drained);
+		}
+
+		r->waiting = 1;
+		while (r->count == 0)
+			pthread_cond_wait(&r->filled, &r->lock);
+		r->waiting = 0;
+
+		kio_chunk* c = &r->ring[r->head];
+		r->buffer = c->data;
+		r->pos = 0;
+		r->len = c->len;
+		r->eof = c->eof;
+		pthread_mutex_unlock(&r->lock);
+	}
+	return r->len - r->pos;
+}
+
+/*
+ * Function that stops the prefetch thread and frees the ring; the
+ * descriptor is left open
+ */
+void reader_close(reader* r)
+{
+	if (r->fd < 0 && r->files == NULL)
+		return;
+
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_signal(&r->drained);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+
+	for (int i = 0; i < KIO_RING; ++i)
+		free(r->ring[i].data);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->filled);
+	pthread_cond_destroy(&r->drained);
+	if (r->ready_fd >= 0)
+		close(r->ready_fd);
+
+	//the thread closes the files of an archive, unless stopped early
+	if (r->files != NULL) {
+		if (r->fd >= 0)
+			close(r->fd);
+		free(r->header);
+		r->files = NULL;
+	}
+}
+
+/*
+ * Function that writes out n buffers at the writer's offset, resuming after
+ * short writes. Returns -1 on error.
+ */
+static int write_all(writer* w, struct iovec* iov, int n)
+{
+	while (n > 0) {
+		ssize_t k = w->seekable ? pwritev(w->fd, iov, n, w->offset) :
+					  writev(w->fd, iov, n);
+		if (k < 0 && errno == EINTR)
+			continue;
+		if (k <= 0)
+			return -1;
+
+		w->offset += k;
+		while (n > 0 && (size_t) k >= iov->iov_len) {
+			k -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *) iov->iov_base + k;
+			iov->iov_len -= k;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Function that writes the segments of the n queued chunks to their files,
+ * closing each file after its last segment; after an error the files are
+ * only closed. Returns -1 on error.
+ */
+static int write_segments(writer* w, int n)
+{
+	int ret = w->error ? -1 : 0;
+
+	for (int i = 0; i < n; ++i) {
+		kio_chunk* c = &w->ring[(w->head + i) % KIO_RING];
+		for (int j = 0; j < c->nseg; ++j) {
+			kio_segment* s = &c->seg[j];
+			int done = 0;
+			while (ret == 0 && s->fd >= 0 && done < s->len) {
+				ssize_t k = pwrite(s->fd, c->data + s->start + done,
+						   s->len - done,
+						   s->offset + done);
+				if (k < 0 && errno == EINTR)
+					continue;
+				if (k <= 0)
+					ret = -1;
+				else
+					done += k;
+			}
+			if (s->close && s->fd >= 0)
+				close(s->fd);
+		}
+	}
+	return ret;
+}
+
+/*
+ * Write-behind thread: writes every queued chunk at once, then hands them
+ * back to the caller
+ */
+static void* writer_run(void* arg)
+{
+	writer* w = arg;
+	struct iovec iov[KIO_RING];
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		while (w->count == 0 && !w->stop)
+			pthread_cond_wait(&w->filled, &w->lock);
+		if (w->count == 0)
+			break;
+
+		int n = w->count;
+		for (int i = 0; i < n; ++i) {
+			kio_chunk* c = &w->ring[(w->head + i) % KIO_RING];
+			iov[i].iov_base = c->data;
+			iov[i].iov_len = c->len;
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		int ret = w->files ? write_segments(w, n) :
+			  w->error ? -1 : write_all(w, iov, n);
+
+		pthread_mutex_lock(&w->lock);
+		if (ret < 0 && !w->error)
+			w->error = errno ? errno : EIO;
+		w->head = (w->head + n) % KIO_RING;
+		w->count -= n;
+		pthread_cond_signal(&w->drained);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static int writer_start(writer* w);
+
+/*
+ * Function that starts writing behind to fd, from its current offset.
+ * Returns -1 if fd is not valid.
+ */
+int writer_open(writer* w, int fd)
+{
+	w->fd = fd;
+	w->len = 0;
+	w->error = 0;
+	w->head = w->tail = w->count = 0;
+	w->stop = 0;
+	w->buffer = NULL;
+	w->files = 0;
+	if (fd < 0)
+		return -1;
+
+	w->offset = lseek(fd, 0, SEEK_CUR);
+	w->seekable = w->offset >= 0;
+	if (!w->seekable)
+		w->offset = 0;
+	return writer_start(w);
+}
+
+/*
+ * Function that starts writing behind to many files, named one after the
+ * other by writer_file(). Returns -1 if the thread cannot be started.
+ */
+int writer_open_files(writer* w)
+{
+	w->fd = -1;
+	w->len = 0;
+	w->error = 0;
+	w->head = w->tail = w->count = 0;
+	w->stop = 0;
+	w->files = 1;
+	w->file_fd = -1;
+	w->file_offset = 0;
+	w->offset = 0;
+	w->seekable = 1;
+
+	for (int i = 0; i < KIO_RING; ++i) {
+		w->ring[i].seg = malloc(KIO_SEGMENTS * sizeof(kio_segment));
+		w->ring[i].nseg = 0;
+	}
+	return writer_start(w);
+}
+
+/*
+ * Function that allocates the ring and starts the write-behind thread
+ */
+static int writer_start(writer* w)
+{
+	for (int i = 0; i < KIO_RING; ++i)
+		w->ring[i].data = malloc(KIO_CHUNK);
+	w->buffer = w->ring[0].data;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->filled, NULL);
+	pthread_cond_init(&w->drained, NULL);
+	return pthread_create(&w->thread, NULL, writer_run, w) == 0 ? 0 : -1;
+}
+
+/*
+ * Function that queues the chunk being filled to the thread and waits for a
+ * free one to continue in
+ */
+static void writer_submit(writer* w)
+{
+	//the segment of the current file ends with the chunk
+	kio_chunk* c = &w->ring[w->tail];
+	if (w->files && c->nseg > 0) {
+		kio_segment* s = &c->seg[c->nseg - 1];
+		s->len = w->len - s->start;
+		w->file_offset += s->len;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	w->ring[w->tail].len = w->len;
+	w->tail = (w->tail + 1) % KIO_RING;
+	w->count++;
+	pthread_cond_signal(&w->filled);
+
+	while (w->count == KIO_RING)
+		pthread_cond_wait(&w->drained, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+
+	w->buffer = w->ring[w->tail].data;
+	w->len = 0;
+
+	//and goes on in the next one
+	if (w->files) {
+		c = &w->ring[w->tail];
+		c->nseg = 0;
+		if (w->file_fd >= 0)
+			c->seg[c->nseg++] = (kio_segment) {
+				w->file_fd, w->file_offset, 0, 0, 0 };
+	}
+}
+
+/*
+ * Function that ends the current file of a writer opened on many, which the
+ * thread closes once written, and sends the next bytes to fd, from its
+ * start; a negative fd drops them
+ */
+void writer_file(writer* w, int fd)
+{
+	kio_chunk* c = &w->ring[w->tail];
+	if (c->nseg > 0) {
+		kio_segment* s = &c->seg[c->nseg - 1];
+		s->len = w->len - s->start;
+		s->close = 1;
+	}
+
+	w->file_fd = -1;
+	if (c->nseg == KIO_SEGMENTS) {
+		writer_submit(w);
+		c = &w->ring[w->tail];
+	}
+
+	c->seg[c->nseg++] = (kio_segment) { fd, 0, w->len, 0, 0 };
+	w->file_fd = fd;
+	w->file_offset = 0;
+}
+
+/*
+ * Function that writes out everything buffered and waits for the disk.
+ * Returns -1 if any write failed since the writer was opened.
+ */
+int writer_flush(writer* w)
+{
+	if (w->buffer == NULL)
+		return -1;
+	if (w->len > 0)
+		writer_submit(w);
+
+	pthread_mutex_lock(&w->lock);
+	while (w->count > 0)
+		pthread_cond_wait(&w->drained, &w->lock);
+	int error = w->error;
+	pthread_mutex_unlock(&w->lock);
+
+	return error ? -1 : 0;
+}
+
+/*
+ * Function that flushes the writer and stops its thread; the descriptor is
+ * left open
+ */
+void writer_close(writer* w)
+{
+	if (w->buffer == NULL)
+		return;
+	if (w->files)
+		writer_file(w, -1);
+	writer_flush(w);
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->filled);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	//pwritev leaves the offset of fd alone; move it past what was written
+	//so that a later writer on the same descriptor appends
+	if (!w->files && w->seekable)
+		lseek(w->fd, w->offset, SEEK_SET);
+
+	for (int i = 0; i < KIO_RING; ++i) {
+		free(w->ring[i].data);
+		if (w->files)
+			free(w->ring[i].seg);
+	}
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->filled);
+	pthread_cond_destroy(&w->drained);
+	w->buffer = NULL;
+}
+
+void writer_write(writer* w, const unsigned char* data, int len)
+{
+	while (len > 0) {
+		if (w->len == KIO_CHUNK)
+			writer_submit(w);
+		int n = KIO_CHUNK - w->len;
+		if (n > len)
+			n = len;
+		memcpy(w->buffer + w->len, data, n);
+		w->len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+/*
+ * Function that writes count copies of byte, as an expanded repeat sequence
+ */
+void writer_fill(writer* w, unsigned char byte, int count)
+{
+	while (count > 0) {
+		if (w->len == KIO_CHUNK)
+			writer_submit(w);
+		int n = KIO_CHUNK - w->len;
+		if (n > count)
+			n = count;
+		memset(w->buffer + w->len, byte, n);
+		w->len += n;
+		count -= n;
+	}
+}
+
+/*
+ * Function that appends len bytes of fd starting at offset, read straight
+ * into the chunk being filled. Returns -1, failing the writer, if fd is
+ * shorter or cannot be read.
+ */
+int writer_copy(writer* w, int fd, long long offset, long long len)
+{
+	while (len > 0) {
+		if (w->len == KIO_CHUNK)
+			writer_submit(w);
+		int want = KIO_CHUNK - w->len;
+		if (want > len)
+			want = len;
+		int n = pread(fd, w->buffer + w->len, want, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			pthread_mutex_lock(&w->lock);
+			if (!w->error)
+				w->error = n < 0 ? errno : EIO;
+			pthread_mutex_unlock(&w->lock);
+			return -1;
+		}
+		w->len += n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Function that computes the CRC32C of the first len bytes of fd without
+ * moving its offset. Returns -1 if the file is shorter or cannot be read.
+ */
+int file_crc(int fd, long long len, unsigned int* crc)
+{
+	unsigned char* buf = malloc(KIO_CHUNK);
+	long long done = 0;
+
+	*crc = 0;
+	while (buf != NULL && done < len) {
+		int want = len - done < KIO_CHUNK ? len - done : KIO_CHUNK;
+		int n = pread(fd, buf, want, done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		*crc = crc32c_update(*crc, buf, n);
+		done += n;
+	}
+
+	free(buf);
+	return done == len ? 0 : -1;
+}
@@ -0,0 +1,122 @@
+#ifndef KIO
+#define KIO
+
+#include <pthread.h>
+
+/*
+ * Buffered file input and output of the Kermit binaries. Both work on any
+ * descriptor, pipes included, so short reads and writes are retried.
+ */
+
+//input is prefetched and output written behind by a thread, through a ring
+//of KIO_RING chunks
+#define KIO_CHUNK (1 << 20)
+#define KIO_RING 4
+
+//millis a writer may hold data back while no more comes
+#define KIO_IDLE_MS 200
+
+//files a chunk may hold the data of when writing many; this bounds the
+//descriptors open at once to KIO_RING * KIO_SEGMENTS
+#define KIO_SEGMENTS 64
+
+/*
+ * Part of a chunk that belongs to one file when writing many: len bytes at
+ * start go to fd at offset, and fd is closed after them if close is set. A
+ * negative fd drops the bytes.
+ */
+typedef struct {
+	int fd;
+	long long offset;
+	int start, len;
+	int close;
+} kio_segment;
+
+typedef struct {
+	unsigned char* data;
+	int len;
+	int eof;
+	kio_segment* seg;
+	int nseg;
+} kio_chunk;
+
+/*
+ * Read-ahead over an input descriptor. A thread fills the chunks of the ring
+ * in order; the consumer reads the chunk in buffer and hands it back once it
+ * reaches len. A chunk is published when full, at end of input, or as soon
+ * as it holds something while the consumer waits, so slow pipes still flow.
+ * A consumer that does not want to block asks reader_ready() first and
+ * waits for ready_fd, an eventfd signalled when a chunk is published.
+ * Opened on a list of files, the thread opens them itself and produces
+ * their archive (see archive_header) instead.
+ */
+typedef struct {
+	int fd;
+	unsigned char* buffer;
+	int pos, len;
+	int eof;
+
+	//files being archived, the next one to open, the bytes of the current
+	//one still to be read and its header, not yet fully produced
+	char* const* files;
+	int nfiles, file;
+	long long remaining;
+	unsigned char* header;
+	int header_len, header_pos;
+
+	kio_chunk ring[KIO_RING];
+	int head, tail, count;
+	int waiting, stop;
+	int ready_fd;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled, drained;
+} reader;
+
+/*
+ * Write-behind over an output descriptor. The caller fills the chunk in
+ * buffer; full chunks are queued to a thread that writes every queued chunk
+ * with a single pwritev (writev if fd cannot seek), so the caller only
+ * blocks when the whole ring is waiting for the disk. When writing many
+ * files, each chunk is split into segments and the thread also closes the
+ * files the caller is done with.
+ */
+typedef struct {
+	int fd;
+	unsigned char* buffer;
+	int len;
+
+	//next file offset the thread writes at, and the first error it met
+	long long offset;
+	int seekable, error;
+
+	//set when writing many files: the one the bytes being added belong
+	//to and how much of it earlier chunks hold
+	int files;
+	int file_fd;
+	long long file_offset;
+
+	kio_chunk ring[KIO_RING];
+	int head, tail, count;
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled, drained;
+} writer;
+
+int reader_open(reader* r, int fd);
+int reader_open_files(reader* r, char* const* files, int n);
+int reader_ready(reader* r);
+int reader_avail(reader* r);
+void reader_close(reader* r);
+int writer_open(writer* w, int fd);
+int writer_open_files(writer* w);
+void writer_file(writer* w, int fd);
+int writer_flush(writer* w);
+void writer_close(writer* w);
+void writer_write(writer* w, const unsigned char* data, int len);
+void writer_fill(writer* w, unsigned char byte, int count);
+int writer_copy(writer* w, int fd, long long offset, long long len);
+int file_crc(int fd, long long len, unsigned int* crc);
+
+#endif
@@ -0,0 +1,84 @@
+#include <time.h>
+#include "klib.h"
+#include "kstats.h"
+
+/*
+ * Monotonic clock in microseconds, used for the retransmission timers
+ */
+unsigned long long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Function that starts the estimator from the timeout advertised by the peer
+ * in the SEND-INIT time field (seconds)
+ */
+void rtt_init(rtt_estimator* e, int time)
+{
+	e->srtt = 0;
+	e->rttvar = 0;
+	e->rto = (time > 0 ? time : TIME) * 1000000LL;
+	if (e->rto > RTO_MAX)
+		e->rto = RTO_MAX;
+}
+
+/*
+ * Function that feeds a round trip measurement into the smoothed RTT and RTT
+ * variance (RFC 6298). Only packets transmitted exactly once may be sampled
+ * (Karn's rule), which also cancels any previous backoff.
+ */
+void rtt_sample(rtt_estimator* e, long long sample)
+{
+	stats_record(&stats.rtt, sample);
+
+	if (e->srtt == 0) {
+		e->srtt = sample;
+		e->rttvar = sample / 2;
+	} else {
+		long long err = e->srtt - sample;
+		if (err < 0)
+			err = -err;
+		e->rttvar = (3 * e->rttvar + err) / 4;
+		e->srtt = (7 * e->srtt + sample) / 8;
+	}
+
+	long long var = 4 * e->rttvar;
+	if (var < RTO_GRANULARITY)
+		var = RTO_GRANULARITY;
+
+	e->rto = e->srtt + var;
+	if (e->rto < RTO_MIN)
+		e->rto = RTO_MIN;
+	if (e->rto > RTO_MAX)
+		e->rto = RTO_MAX;
+}
+
+/*
+ * Function that doubles the timeout after a packet was lost
+ */
+void rtt_backoff(rtt_estimator* e)
+{
+	e->rto *= 2;
+	if (e->rto > RTO_MAX)
+		e->rto = RTO_MAX;
+}
+
+/*
+ * Current timeout in milliseconds, rounded up for poll()
+ */
+int rtt_timeout_ms(rtt_estimator* e)
+{
+	return (e->rto + 999) / 1000;
+}
+
+/*
+ * Current timeout in whole seconds, as carried by the SEND-INIT time field
+ */
+unsigned char rtt_time_field(rtt_estimator* e)
+{
+	long long time = (e->rto + 999999) / 1000000;
+	return time > 0xff ? 0xff : time;
+}
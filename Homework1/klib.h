@@ -1,3 +1,6 @@
+#ifndef KLIB
+#define KLIB
+
 #include "lib.h"
 
 //init package constants
@@ -11,10 +14,27 @@
 #define QBIN 0x00                                                               
 #define CHKT 0x00                                                               
 #define REPT 0x00                                                               
+#define REPT_PREFIX '~'
 #define CAPA 0x00                                                               
 #define R 0x00  
+#define WINDO 0x1f
 #define MARK 0x0d
 
+//block check types of the chkt field: the CCITT CRC16, which an unset
+//field also means and which the SEND-INIT exchange itself always uses, and
+//CRC32C; the check takes CHECK_LEN bytes of the trailer
+#define CHKT_CRC16 '3'
+#define CHKT_CRC32C 'C'
+#define CHECK_LEN(chkt) ((chkt) == CHKT_CRC32C ? 4 : 2)
+
+//capabilities advertised in the capa field
+#define CAPA_LP 0x02
+#define CAPA_SWS 0x04
+#define CAPA_AT 0x08
+#define CAPA_RESEND 0x10
+#define CAPA_DELTA 0x20
+#define CAPA_ARCHIVE 0x40
+
 
 //types of packages
 #define TYPE_S 'S'
@@ -24,33 +44,102 @@
 #define TYPE_B 'B'
 #define TYPE_Y 'Y'
 #define TYPE_N 'N'
+#define TYPE_A 'A'
+#define TYPE_P 'P'
+#define TYPE_H 'H'
+#define TYPE_E 'E'
+
+//attributes of an 'A' package are tag, length, value, all sent in decimal:
+//the exact file size and, when resuming, the offset the data starts at
+#define ATTR_LENGTH '1'
+#define ATTR_OFFSET '+'
+//the acknowledgement of an 'F' package when resuming: the size of the
+//receiver's copy (ATTR_LENGTH) and the CRC32C of that much of it
+#define ATTR_CHECK 'C'
+//an 'H' package asks for the signatures of count blocks of the given size,
+//starting with block index; an 'A' package carrying the block size announces
+//that the data is a delta against those blocks. The 'Z' package of a delta
+//carries the size and CRC32C of the whole file, and an 'H' package without a
+//block size, sent once it is acknowledged, asks for those of the copy the
+//receiver ended up with
+#define ATTR_BLOCK 'b'
+#define ATTR_INDEX 'i'
+#define ATTR_COUNT 'n'
 
 //receiver file prefix
 #define RECV_FILE_PREFIX "recv_"
+//a delta is written next to the old copy, which it replaces once complete
+#define DELTA_SUFFIX ".part"
+//name sent for the standard input when none is given
+#define STREAM_NAME "stdin"
+//name sent in the single 'F' package of an archive, and the longest name of
+//a file inside one
+#define ARCHIVE_NAME "archive"
+#define ARCHIVE_NAME_MAX 4096
 
 #define MODULO_SEQ 64
+#define MODULO_SEQ_EXT 256
+
+//sliding window limits; windows larger than MODULO_SEQ / 2 - 1 switch to
+//the extended sequence space
+#define MAX_WINDO 0x7f
+#define WINDOW_SLOTS (MAX_WINDO + 1)
+#define SEQ_SPACE(w) ((w) < MODULO_SEQ / 2 ? MODULO_SEQ : MODULO_SEQ_EXT)
+
+//number of timeouts a packet may experience before giving up; together
+//with the exponential backoff this bounds how long a dead link is retried
+#define MAX_TRIES 10
+
+//runs shorter than REPT_MIN are cheaper as literals; REPT_MAX fits the
+//one-byte count that follows the repeat prefix
+#define REPT_MIN 4
+#define REPT_MAX 0xff
+
+//retransmission timeout bounds and clock granularity, in microseconds
+#define RTO_MIN 20000
+#define RTO_MAX 60000000
+#define RTO_GRANULARITY 1000
 
 
 #define S_LEN sizeof(s_pkg)
 #define H_LEN sizeof(header)
+#define HX_LEN sizeof(header_x)
 #define T_LEN sizeof(trailer)
 #define P_LEN sizeof(pkg)
 
+//longest data field of an extended-length packet
+#define MAXLX (sizeof(((msg *) 0)->payload) - HX_LEN - T_LEN)
+
 #pragma pack(1)
 
 typedef struct {
 	unsigned char maxl, time, npad, padc, eol;
 	unsigned char qctl, qbin, chkt, rept, capa, r;
+	unsigned char windo, maxlx1, maxlx2;
+	//extension: packets per FEC block and parity packets per block
+	unsigned char fecn, feck;
+	//extension: number the sender picked for the transfer, echoed back;
+	//0 if it picked none
+	unsigned char sid[4];
 } s_data;
 
 typedef struct {
 	unsigned char soh, len, seq, type;
 } header;
 
-typedef struct {	
-	unsigned short check;
+//a zero len announces the extended header: lenx1 and lenx2 hold the number
+//of bytes that follow hcheck, hcheck protects the header fields
+typedef struct {
+	unsigned char soh, len, seq, type;
+	unsigned char lenx1, lenx2, hcheck;
+} header_x;
+
+//the check fills the first CHECK_LEN bytes and the mark follows it, so the
+//struct is only the room for the longest trailer
+typedef struct {
+	unsigned char check[4];
 	unsigned char mark;
-} trailer; 
+} trailer;
 
 typedef struct {
 	header h;
@@ -63,6 +152,25 @@ typedef struct {
 	trailer t;
 } pkg;
 
+//every file of an archive is this header, its name and size bytes of data;
+//a header with an empty name ends the archive
+typedef struct {
+	unsigned short name_len;
+	unsigned short mode;
+	unsigned long long size;
+} archive_header;
+
 #pragma pack()
 
+typedef struct {
+	long long srtt, rttvar, rto;
+} rtt_estimator;
+
+unsigned long long now_us();
+void rtt_init(rtt_estimator* e, int time);
+void rtt_sample(rtt_estimator* e, long long sample);
+void rtt_backoff(rtt_estimator* e);
+int rtt_timeout_ms(rtt_estimator* e);
+unsigned char rtt_time_field(rtt_estimator* e);
 
+#endif
@@ -0,0 +1,68 @@
+#include "kpath.h"
+
+//transmissions after which the counts of a path are halved, so that
+//recent losses weigh more
+#define PATH_HISTORY 1024
+
+void path_init(kpath* p, int id, int time, int mode, int max)
+{
+	p->id = id;
+	rtt_init(&p->rtt, time);
+	cong_init(&p->cong, mode, max);
+	p->inflight = 0;
+	p->sent = p->failed = 0;
+	p->order = p->acked_order = 0;
+	p->backed_off = 0;
+	p->burst_len = 0;
+}
+
+void path_sent(kpath* p)
+{
+	if (++p->sent > PATH_HISTORY) {
+		p->sent /= 2;
+		p->failed /= 2;
+	}
+}
+
+/*
+ * Function that counts a NAK or a timeout of a packet sent on the path
+ */
+void path_failed(kpath* p)
+{
+	if (p->failed < p->sent)
+		p->failed++;
+}
+
+/*
+ * Expected time, in microseconds, for a packet to get through the path; a
+ * path not measured yet costs nothing, so it is tried
+ */
+double path_cost(const kpath* p)
+{
+	double ok = p->sent ? 1 - (double) p->failed / p->sent : 1;
+	if (ok < 0.01)
+		ok = 0.01;
+	return p->rtt.srtt / ok;
+}
+
+/*
+ * Function that returns the cheapest of the n paths, among those with room
+ * in their congestion window if room is set; -1 if none has room
+ */
+int path_pick(const kpath* paths, int n, int room)
+{
+	int best = -1;
+	double least = 0;
+
+	for (int i = 0; i < n; ++i) {
+		if (room && paths[i].inflight >= cong_window(&paths[i].cong))
+			continue;
+		double c = path_cost(&paths[i]);
+		if (best < 0 || c < least ||
+		    (c == least && paths[i].inflight < paths[best].inflight)) {
+			best = i;
+			least = c;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,47 @@
+#ifndef KPATH
+#define KPATH
+
+#include "lib.h"
+#include "klib.h"
+#include "kcong.h"
+#include "kreactor.h"
+
+/*
+ * Paths of a transfer striped over several links, one socket each. Every
+ * path keeps its own RTT estimate, congestion window and ratio of failed
+ * transmissions, while the sequence space and the receiver's window are
+ * shared, so packets are put back in order whatever path they took. As
+ * with MPTCP's default scheduler, a packet goes on the fastest path with
+ * room in its congestion window; paths are ranked by the time a packet
+ * takes to get through, the smoothed RTT over the share of transmissions
+ * that were not lost.
+ */
+
+typedef struct {
+	//index of the path in lib.c
+	int id;
+	rtt_estimator rtt;
+	congestion cong;
+	//packets last sent on it and not yet acknowledged
+	int inflight;
+	//transmissions and how many timed out or were NAKed
+	unsigned int sent, failed;
+	//transmissions numbered in the order they left on the path, and the
+	//latest one acknowledged: links keep the order of their packets, so
+	//only those sent before it can be lost
+	unsigned long long order, acked_order;
+	//set once its timeout was backed off in the current round of expiries
+	int backed_off;
+	//packets queued for the next burst
+	const msg* burst[MAX_BATCH];
+	int burst_len;
+	kwatch watch;
+} kpath;
+
+void path_init(kpath* p, int id, int time, int mode, int max);
+void path_sent(kpath* p);
+void path_failed(kpath* p);
+double path_cost(const kpath* p);
+int path_pick(const kpath* paths, int n, int room);
+
+#endif
@@ -0,0 +1,171 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "kreactor.h"
+
+/*
+ * Function that starts an empty loop. Returns -1 if epoll or the timerfd
+ * cannot be created.
+ */
+int reactor_open(reactor* r)
+{
+	r->ntimers = 0;
+	r->armed = 0;
+	r->timer.fn = NULL;
+	r->timer.arg = NULL;
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	r->timer.fd = timerfd_create(CLOCK_MONOTONIC,
+				     TFD_NONBLOCK | TFD_CLOEXEC);
+	if (r->epfd < 0 || r->timer.fd < 0 || reactor_add(r, &r->timer) < 0) {
+		reactor_close(r);
+		return -1;
+	}
+	return 0;
+}
+
+void reactor_close(reactor* r)
+{
+	if (r->timer.fd >= 0)
+		close(r->timer.fd);
+	if (r->epfd >= 0)
+		close(r->epfd);
+	r->timer.fd = r->epfd = -1;
+}
+
+/*
+ * Function that starts watching w->fd until reactor_remove()
+ */
+int reactor_add(reactor* r, kwatch* w)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = w;
+	return epoll_ctl(r->epfd, EPOLL_CTL_ADD, w->fd, &ev);
+}
+
+void reactor_remove(reactor* r, kwatch* w)
+{
+	epoll_ctl(r->epfd, EPOLL_CTL_DEL, w->fd, NULL);
+}
+
+void timer_init(ktimer* t, reactor_fn fn, void* arg)
+{
+	t->deadline = 0;
+	t->index = -1;
+	t->fn = fn;
+	t->arg = arg;
+}
+
+static void heap_set(reactor* r, int i, ktimer* t)
+{
+	r->heap[i] = t;
+	t->index = i;
+}
+
+/*
+ * Function that moves the timer at i up or down to its place in the heap
+ */
+static void heap_fix(reactor* r, int i)
+{
+	ktimer* t = r->heap[i];
+
+	while (i > 0 && r->heap[(i - 1) / 2]->deadline > t->deadline) {
+		heap_set(r, i, r->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	while (2 * i + 1 < r->ntimers) {
+		int c = 2 * i + 1;
+		if (c + 1 < r->ntimers &&
+		    r->heap[c + 1]->deadline < r->heap[c]->deadline)
+			c++;
+		if (r->heap[c]->deadline >= t->deadline)
+			break;
+		heap_set(r, i, r->heap[c]);
+		i = c;
+	}
+	heap_set(r, i, t);
+}
+
+/*
+ * Function that (re)arms t to fire at deadline
+ */
+void timer_arm(reactor* r, ktimer* t, unsigned long long deadline)
+{
+	t->deadline = deadline;
+	if (t->index < 0) {
+		//there is a timer per slot of the window at most, plus a few
+		if (r->ntimers == REACTOR_TIMERS)
+			return;
+		heap_set(r, r->ntimers++, t);
+	}
+	heap_fix(r, t->index);
+}
+
+void timer_cancel(reactor* r, ktimer* t)
+{
+	int i = t->index;
+
+	if (i < 0)
+		return;
+	t->index = -1;
+	if (i == --r->ntimers)
+		return;
+	heap_set(r, i, r->heap[r->ntimers]);
+	heap_fix(r, i);
+}
+
+/*
+ * Function that sets the timerfd to the earliest deadline, if it changed
+ */
+static void reactor_arm(reactor* r)
+{
+	unsigned long long deadline = r->ntimers ? r->heap[0]->deadline : 0;
+	struct itimerspec its;
+
+	if (deadline == r->armed)
+		return;
+	//a zero value disarms it, and no deadline is that early
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / 1000000;
+	its.it_value.tv_nsec = deadline % 1000000 * 1000;
+	timerfd_settime(r->timer.fd, TFD_TIMER_ABSTIME, &its, NULL);
+	r->armed = deadline;
+}
+
+/*
+ * Function that waits for the next events and handles them: readable
+ * descriptors first, so that a reply that arrived cancels its timer, then
+ * every timer whose deadline passed. Returns -1 if epoll fails.
+ */
+int reactor_run(reactor* r)
+{
+	struct epoll_event ev[REACTOR_EVENTS];
+
+	reactor_arm(r);
+	int n = epoll_wait(r->epfd, ev, REACTOR_EVENTS, -1);
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+
+	for (int i = 0; i < n; ++i) {
+		kwatch* w = ev[i].data.ptr;
+		if (w == &r->timer) {
+			unsigned long long expirations;
+			if (read(w->fd, &expirations, sizeof(expirations)) > 0)
+				r->armed = 0;
+		} else {
+			w->fn(w->arg);
+		}
+	}
+
+	unsigned long long crt = now_us();
+	while (r->ntimers > 0 && r->heap[0]->deadline <= crt) {
+		ktimer* t = r->heap[0];
+		timer_cancel(r, t);
+		t->fn(t->arg);
+	}
+	return n;
+}
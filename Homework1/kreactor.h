@@ -0,0 +1,57 @@
+#ifndef KREACTOR
+#define KREACTOR
+
+#include "klib.h"
+
+/*
+ * Event loop of the Kermit binaries: descriptors are watched with epoll and
+ * timers are kept in a binary heap ordered by deadline, the earliest of
+ * which arms a timerfd. Every wait of an endpoint is one reactor_run().
+ */
+
+//timers armed at once: one per packet of the window and a few more
+#define REACTOR_TIMERS (WINDOW_SLOTS + 16)
+//events handled per wakeup
+#define REACTOR_EVENTS 16
+
+typedef void (*reactor_fn)(void* arg);
+
+/*
+ * Timer calling fn(arg) once its deadline, in now_us() time, is reached;
+ * index is its place in the heap, -1 while it is not armed
+ */
+typedef struct {
+	unsigned long long deadline;
+	int index;
+	reactor_fn fn;
+	void* arg;
+} ktimer;
+
+/*
+ * Descriptor calling fn(arg) whenever it is readable
+ */
+typedef struct {
+	int fd;
+	reactor_fn fn;
+	void* arg;
+} kwatch;
+
+typedef struct {
+	int epfd;
+	kwatch timer;
+	//deadline the timerfd is set to, 0 if it is disarmed
+	unsigned long long armed;
+	ktimer* heap[REACTOR_TIMERS];
+	int ntimers;
+} reactor;
+
+int reactor_open(reactor* r);
+void reactor_close(reactor* r);
+int reactor_add(reactor* r, kwatch* w);
+void reactor_remove(reactor* r, kwatch* w);
+int reactor_run(reactor* r);
+void timer_init(ktimer* t, reactor_fn fn, void* arg);
+void timer_arm(reactor* r, ktimer* t, unsigned long long deadline);
+void timer_cancel(reactor* r, ktimer* t);
+
+#endif
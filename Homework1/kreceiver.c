@@ -1,80 +1,230 @@
+#define _GNU_SOURCE
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "lib.h"
 #include "klib.h"
+#include "kcodec.h"
+#include "kstats.h"
+#include "kio.h"
+#include "kfec.h"
+#include "kdelta.h"
+#include "kreactor.h"
+#include "kring.h"
+#include "kserver.h"
 
 #define HOST "127.0.0.1"
 #define PORT 10001
 
+//out-of-order packets held until the missing ones arrive
+msg* window[WINDOW_SLOTS];
+char nak_sent[WINDOW_SLOTS];
+unsigned long long nak_at[WINDOW_SLOTS];
+unsigned long long held_at[WINDOW_SLOTS];
+int window_size = 1;
+int seq_mod = MODULO_SEQ;
 
-/* 
- * Function that creates the initial 'S' acknowledgement package, based on 
- * the received initial package	
- */ 
-unsigned char* create_s_ack(msg* r, int seq)
-{
-	unsigned char* buffer = malloc(S_LEN * sizeof(unsigned char));
-        s_pkg s;
-	
-        s.h.soh = r->payload[0];
-        s.h.len = r->payload[1];
-        s.h.seq = r->payload[2];
-        s.h.type = r->payload[3];
-
-        s.d.maxl = r->payload[4];
-        s.d.time = r->payload[5];
-        s.d.npad = r->payload[6];
-        s.d.padc = r->payload[7];
-        s.d.eol = r->payload[8];
-        s.d.qctl = r->payload[9];
-        s.d.qbin = r->payload[10];
-        s.d.chkt = r->payload[11];
-        s.d.rept = r->payload[12];
-        s.d.capa = r->payload[13];
-        s.d.r = r->payload[14];
-
-        int crc_len = S_LEN - T_LEN;
-        unsigned char crc_data[crc_len];
-        memcpy(crc_data, &s, crc_len);
-
-        s.t.check = crc16_ccitt(crc_data, crc_len);
-        s.t.mark = MARK;
-        memcpy(buffer, &s, S_LEN);
-	
-        return buffer;
-}
-
-/*
- * Check if timeout takes place during the transmission of the initial 
- * package
- */ 
-msg* check_timeout_s()
-{
-        int ctr = 3;
-        while (ctr > 0) {
-                msg *r = receive_message_timeout(1000 * TIME);
-                if (r == NULL)
-                        ctr--;
-                else
-                        return r;
-        }
-        return NULL;
-}
+//absolute number of the next packet to be delivered; the SEND-INIT is the
+//first, and they match sequence numbers modulo either space
+#define RN_FIRST MODULO_SEQ_EXT
+unsigned int rn = RN_FIRST;
+//when the last packet came, to tell a gone sender from a slow one
+unsigned long long heard_at;
+//session id of the accepted SEND-INIT, and whether one of another came
+unsigned int session_sid;
+int restarted;
+
+rtt_estimator rtt;
+
+/*
+ * Repeat-count decoder state, kept between packets: the prefix agreed in
+ * SEND-INIT (0 if none), whether a prefix or a count was just read, and the
+ * block reference being read after a zero count
+ */
+typedef struct {
+	unsigned char prefix;
+	int state;
+	int count;
+	unsigned char copy[DELTA_COPY];
+	int copied;
+} rept_decoder;
+
+#define REPT_LITERAL 0
+#define REPT_COUNT 1
+#define REPT_BYTE 2
+#define REPT_COPY 3
+
+rept_decoder rept;
+
+//FEC block size and parity packets per block, 0 if FEC is off
+int fec_n, fec_k;
+
+//symbols of the packets received lately, by absolute number
+#define FEC_SLOTS (2 * WINDOW_SLOTS)
+unsigned char fec_sym[FEC_SLOTS][FEC_SYMBOL];
+int fec_len[FEC_SLOTS];
+unsigned int fec_abs[FEC_SLOTS];
+
+/*
+ * Parity received for a block of n packets starting at packet start; bit j
+ * of rows is set once parity j is held
+ */
+#define FEC_BLOCKS 4
+typedef struct {
+	unsigned int start;
+	int n, len;
+	unsigned int rows;
+	unsigned char parity[FEC_MAX_K][FEC_SYMBOL];
+} fec_block;
+
+fec_block fec_blocks[FEC_BLOCKS];
+
+//packets before this one are covered by parity already received, so a
+//missing one cannot be waited for
+unsigned int fec_covered = 1;
+
+//destination of the data of the current file
+writer out;
+
+//set if every file is written to the standard output, kept in out_fd
+int stream;
+int out_fd = -1;
+
+//acknowledgement of the SEND-INIT, repeated if the sender asks again
+msg init_ack;
+
+//set if the sender may resume files from the copy the receiver holds
+int resume;
+
+//set if the sender may send files as deltas against the copy held
+int delta;
+
+//acknowledgement of the last 'F' package when resuming or receiving deltas,
+//repeated if the sender asks again, and the copy it describes, which 'H'
+//packages ask about
+msg file_ack;
+char held_name[sizeof(RECV_FILE_PREFIX) + MAXLX];
+
+//acknowledgement of the last 'H' package, carrying block signatures
+msg sig_ack;
+
+//old copy the delta being received refers to, with its block size, and the
+//file the new copy is written to until EOF
+int basis_fd = -1;
+int basis_block;
+char* part_name;
+
+//set if the files arrive as one archive, unpacked as it is written
+int archive;
 
 /*
- * Function that sends the acknowledgement of the initial package
+ * Archive unpacker state: the header and name of the next file, gathered
+ * byte by byte since they may straddle packets, the data of the current
+ * file still to come and the number of files met
  */
-void send_ack_s(int seq, msg* r)
+typedef struct {
+	unsigned char header[sizeof(archive_header) + ARCHIVE_NAME_MAX];
+	int header_len;
+	unsigned long long remaining;
+	int files, done;
+} unpacker;
+
+unpacker unpack;
+
+//event loop every wait goes through: the socket of every path and a
+//timer that fires when nothing arrived for a timeout
+reactor loop;
+kwatch path_watch[MAX_PATHS];
+int npaths;
+ktimer idle;
+int idle_expired;
+
+//packets drained from the socket of a path in one call, not yet handled;
+//their replies go back on the same path
+msg* batch[MAX_BATCH];
+int batch_len, batch_pos, batch_path;
+
+//packets delivered in order, handed from the network thread, which
+//receives and acknowledges them, to the disk stage, which decodes and
+//writes them; once it is full the network thread keeps them in its window
+//and waits to be told through stage_watch that there is room again
+packet_ring stage;
+kwatch stage_watch;
+int stage_room;
+pthread_t disk;
+
+//replies to a batch, sent together once it is handled
+msg replies[MAX_BATCH];
+const msg* reply_ptrs[MAX_BATCH];
+int replies_len;
+
+/*
+ * Function that accepts the sender's SEND-INIT parameters, lowering them to
+ * what the receiver supports
+ */
+void negotiate(s_data* d)
 {
-        msg *s = malloc(sizeof(msg));
+	rtt_init(&rtt, d->time);
+	d->time = rtt_time_field(&rtt);
+
+	if ((d->capa & CAPA_SWS) && d->windo > 1) {
+		window_size = d->windo < MAX_WINDO ? d->windo : MAX_WINDO;
+		seq_mod = SEQ_SPACE(window_size);
+		d->windo = window_size;
+	} else {
+		d->capa &= ~CAPA_SWS;
+		d->windo = 1;
+	}
+
+	if (window_size > 1 && d->fecn > 0 && d->feck > 0) {
+		fec_n = d->fecn < window_size ? d->fecn : window_size;
+		if (fec_n > FEC_MAX_N)
+			fec_n = FEC_MAX_N;
+		fec_k = d->feck < FEC_MAX_K ? d->feck : FEC_MAX_K;
+	} else {
+		fec_n = fec_k = 0;
+	}
+	d->fecn = fec_n;
+	d->feck = fec_k;
+
+	//resuming needs the 'A' package to carry the offset
+	resume = (d->capa & CAPA_RESEND) && (d->capa & CAPA_AT);
+	if (!resume)
+		d->capa &= ~CAPA_RESEND;
 
-        unsigned char* buffer = create_s_ack(r, seq);
-        memcpy(s->payload, buffer, S_LEN);
-        s->len = S_LEN;
-	send_message(s);
+	//a delta announces its blocks in the 'A' package and escapes block
+	//references with the repeat prefix
+	delta = (d->capa & CAPA_DELTA) && (d->capa & CAPA_AT) && d->rept;
+	if (!delta)
+		d->capa &= ~CAPA_DELTA;
+
+	//an archive is unpacked into files, so it cannot go to stdout
+	archive = (d->capa & CAPA_ARCHIVE) && !stream;
+	if (!archive)
+		d->capa &= ~CAPA_ARCHIVE;
+
+	//any prefix the sender picks is fine, the decoder is agnostic
+	rept.prefix = d->rept;
+
+	//a block check not known here falls back to CRC16, with which the
+	//acknowledgement itself still goes
+	set_block_check(d->chkt);
+	d->chkt = codec_chkt;
+
+	int maxlx = d->maxlx1 << 8 | d->maxlx2;
+	if ((d->capa & CAPA_LP) && maxlx > MAXL) {
+		if (maxlx > (int) MAXLX)
+			maxlx = MAXLX;
+		d->maxlx1 = maxlx >> 8;
+		d->maxlx2 = maxlx & 0xff;
+	} else {
+		d->capa &= ~CAPA_LP;
+		d->maxlx1 = d->maxlx2 = 0;
+	}
 }
 
 /*
@@ -82,23 +232,12 @@ void send_ack_s(int seq, msg* r)
  */
 void send_nak(int seq)
 {
-        msg* s = malloc(sizeof(msg));
-        pkg n;  
-        n.h.soh = SOH;
-        n.h.len = P_LEN - 2;
-        n.h.seq = seq;
-        n.h.type = TYPE_N;
-
-        unsigned char crc_data[H_LEN];
-        memcpy(crc_data, &n, H_LEN);
-
-        n.t.check = crc16_ccitt(crc_data, H_LEN);
-        n.t.mark = MARK;
-
-        memcpy(s->payload, &n, P_LEN);
-	s->len = P_LEN;
-	
-        send_message(s);
+        msg s;
+        const msg* out = &s;
+        encode_ctl(&s, seq, TYPE_N);
+        send_messages_on(batch_path, &out, 1);
+        stats_sent(s.len);
+        stats.naks++;
 }
 
 /* 
@@ -107,169 +246,859 @@ void send_nak(int seq)
  */	
 int check_crc(msg *r)
 {
-        int crc_len = r->len - T_LEN;
-        unsigned char crc_data[crc_len];
-        memcpy(crc_data, r->payload, crc_len);
-
-        unsigned short crc = crc16_ccitt(crc_data, crc_len);
-
-        unsigned short actual_crc = r->payload[r->len - 2];
-        memcpy(&actual_crc, r->payload + (r->len - T_LEN), 2);
-
-        if (actual_crc != crc) {
-                printf("[incorrect crc] seq = %d\n", r->payload[2]);
+        stats_received(r->len);
+        if (check_packet(r) < 0) {
+                stats.crc_failures++;
 		return -1;
         } else  {
                 return 0;
         }
 }
 
-/* 
- * Function that ensures that the initial package has been correctly received
- */ 
-msg* receive_s(int seq)
+/*
+ * Function that builds the name of the received copy of a file
+ */
+void file_name(frame* f, char* name)
 {
-        msg *r = check_timeout_s();
+        strcpy(name, RECV_FILE_PREFIX);
+        memcpy(name + strlen(RECV_FILE_PREFIX), f->data, f->len);
+        name[strlen(RECV_FILE_PREFIX) + f->len] = '\0';
+}
 
-        if (r == NULL)
-                return NULL;
+/*
+ * Function that puts at data the attributes of the copy held of the file
+ * named by the last 'F' package: its size and, if check is set, its CRC.
+ * Returns the number of bytes written.
+ */
+int held_attributes(unsigned char* data, int check)
+{
+        unsigned int crc = 0;
+        long long size = 0;
 
-        while (check_crc(r) < 0) {
-                send_nak(seq);
-                r = check_timeout_s();
-                if (r == NULL)
-                        return NULL;
+        int fd = held_name[0] != '\0' ? open(held_name, O_RDONLY) : -1;
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+                size = st.st_size;
+                if (check && file_crc(fd, size, &crc) < 0)
+                        size = crc = 0;
         }
+        if (fd >= 0)
+                close(fd);
 
-        send_ack_s(seq, r);
-	
-        return r;
+        int n = attr_put(data, ATTR_LENGTH, size);
+        if (check)
+                n += attr_put(data + n, ATTR_CHECK, crc);
+        return n;
 }
 
-/* 
- * Function that sends the acknowledgement message to the sender 
+/*
+ * Function that builds in file_ack the acknowledgement of an 'F' package
+ * when resuming or receiving deltas: the size of the copy already held and,
+ * when resuming, the CRC of it
  */
-void send_ack(int seq)
+void build_file_ack(msg* r)
 {
-        msg* s = malloc(sizeof(msg));
+        unsigned char data[MAXLX];
+        frame f;
 
-        pkg a;
-        a.h.soh = SOH;
-        a.h.len = P_LEN - 2;
-        a.h.seq = seq;
-        a.h.type = TYPE_Y;
+        parse_packet(r, &f);
+        held_name[0] = '\0';
+        if (!stream)
+                file_name(&f, held_name);
+        encode_packet(&file_ack, f.seq, TYPE_Y, data,
+                      held_attributes(data, resume));
+}
 
-        unsigned char crc_data[H_LEN];
-        memcpy(crc_data, &a, H_LEN);
+void stage_wait(int drain);
 
-        a.t.check = crc16_ccitt(crc_data, H_LEN);
-        a.t.mark = MARK;
+/*
+ * Function that builds in sig_ack the acknowledgement of an 'H' package:
+ * the signatures of the blocks it asks for, as far as the copy holds them.
+ * Without a block size it asks after a delta, and gets the size and CRC of
+ * the copy once the disk stage is done with the delta.
+ */
+void build_sig_ack(msg* r)
+{
+        unsigned char data[MAXLX];
+        int n = 0;
+        frame f;
 
-        memcpy(s->payload, &a, P_LEN);
-	s->len = P_LEN;
-        send_message(s);
+        parse_packet(r, &f);
+        long long block = attr_get(&f, ATTR_BLOCK);
+        if (block < 0) {
+                stage_wait(1);
+                encode_packet(&sig_ack, f.seq, TYPE_Y, data,
+                              held_attributes(data, 1));
+                return;
+        }
+        long long index = attr_get(&f, ATTR_INDEX);
+        long long count = attr_get(&f, ATTR_COUNT);
+        if (block >= DELTA_MIN_BLOCK && block <= DELTA_MAX_BLOCK &&
+            index >= 0 && count > 0 && count <= (long long) MAXLX / DELTA_SIG) {
+                int fd = open(held_name, O_RDONLY);
+                if (fd >= 0) {
+                        n = DELTA_SIG * delta_signatures(fd, block, index,
+                                                         count, data);
+                        close(fd);
+                }
+        }
+        encode_packet(&sig_ack, f.seq, TYPE_Y, data, n);
 }
 
-/* 
- * Utility function that ensures that a package is received properly
- */ 
-msg* check_timeout()
-{
-	msg* r = receive_message_timeout(1000 * TIME);
-	
-	while (r == NULL) 
-		r = receive_message_timeout(1000 * TIME);
-	
+/*
+ * Function that builds in init_ack the acknowledgement of the SEND-INIT,
+ * carrying the parameters accepted from the sender's offer
+ */
+void build_init_ack(msg* r)
+{
+        frame f;
+        s_data d;
+
+        parse_packet(r, &f);
+        parse_s(&f, &d);
+        negotiate(&d);
+        session_sid = s_session(&d);
+        encode_s(&init_ack, f.seq, TYPE_Y, &d);
+}
+
+/*
+ * Function that returns the acknowledgement of r if it carries data: the
+ * negotiated parameters for the SEND-INIT, what the receiver holds for an
+ * 'F' package when resuming or receiving deltas, signatures for an 'H' one.
+ * A fresh 'F' is examined again, a repeated one gets the same answer.
+ * Returns NULL if a plain ACK will do.
+ */
+msg* prepare_ack(msg* r, int fresh)
+{
+        if (r->payload[3] == TYPE_S) {
+                if (fresh)
+                        build_init_ack(r);
+                return &init_ack;
+        }
+        if (delta && r->payload[3] == TYPE_H) {
+                build_sig_ack(r);
+                return &sig_ack;
+        }
+        if ((!resume && !delta) || r->payload[3] != TYPE_F)
+                return NULL;
+        if (fresh || file_ack.len == 0 || file_ack.payload[2] != r->payload[2])
+                build_file_ack(r);
+        return &file_ack;
+}
+
+/*
+ * Function that sends the queued replies
+ */
+void flush_replies()
+{
+	if (replies_len > 0)
+		send_messages_on(batch_path, reply_ptrs, replies_len);
+	replies_len = 0;
+}
+
+/*
+ * Function that queues an ACK or a NAK until the current batch is handled
+ */
+void queue_reply(int seq, char type)
+{
+	if (replies_len == MAX_BATCH)
+		flush_replies();
+	encode_ctl(&replies[replies_len], seq, type);
+	reply_ptrs[replies_len] = &replies[replies_len];
+	replies_len++;
+	stats_sent(replies[replies_len - 1].len);
+	if (type == TYPE_N)
+		stats.naks++;
+}
+
+/*
+ * Function that queues the acknowledgement of r, which carries data for an
+ * 'F' or an 'H' package; fresh tells a new package from a copy
+ */
+void queue_ack(msg* r, int fresh)
+{
+	msg *ack = prepare_ack(r, fresh);
+	if (ack == NULL) {
+		queue_reply((unsigned char) r->payload[2], TYPE_Y);
+		return;
+	}
+
+	if (replies_len == MAX_BATCH)
+		flush_replies();
+	memcpy(&replies[replies_len], ack, sizeof(msg));
+	reply_ptrs[replies_len] = &replies[replies_len];
+	replies_len++;
+	stats_sent(ack->len);
+}
+
+/*
+ * Function that drains the packets queued on the socket of a path into the
+ * batch; a path that is readable while the batch is taken waits for the
+ * next one
+ */
+void socket_readable(void* arg)
+{
+	if (batch_len > 0)
+		return;
+	batch_path = (kwatch*) arg - path_watch;
+	batch_len = recv_messages_on(batch_path, batch, MAX_BATCH, 0);
+	if (batch_len < 0)
+		batch_len = 0;
+}
+
+void idle_timeout(void* arg)
+{
+	idle_expired = 1;
+}
+
+void stage_readable(void* arg)
+{
+	unsigned long long count;
+	read(stage_watch.fd, &count, sizeof(count));
+	stage_room = 1;
+}
+
+/*
+ * Function that waits until the disk stage frees a slot of the ring, or
+ * with drain set until it is done with every packet delivered. The socket
+ * is left alone meanwhile: the packets held are acknowledged, so the
+ * sender's window moves past the next one to deliver, and whatever it
+ * sends beyond ours waits in the socket until the held ones are delivered.
+ */
+void stage_wait(int drain)
+{
+	flush_replies();
+	for (int i = 0; i < npaths; ++i)
+		reactor_remove(&loop, &path_watch[i]);
+	int failed = 0;
+	while (!failed && !(drain ? ring_drained(&stage) : ring_room(&stage)))
+		for (stage_room = 0; !stage_room && !failed; )
+			failed = reactor_run(&loop) < 0;
+	for (int i = 0; i < npaths; ++i)
+		reactor_add(&loop, &path_watch[i]);
+}
+
+/*
+ * Function that returns the next packet drained from the socket, running
+ * the loop for a new batch once the previous one is handled. Buffers handed
+ * out are replaced, so the caller owns them. Returns NULL if nothing came
+ * within the timeout.
+ */
+msg* next_packet()
+{
+	if (batch_pos == batch_len) {
+		flush_replies();
+		for (int i = 0; i < MAX_BATCH; ++i)
+			if (batch[i] == NULL)
+				batch[i] = msg_acquire();
+
+		batch_pos = batch_len = 0;
+		idle_expired = 0;
+		timer_arm(&loop, &idle, now_us() + rtt.rto);
+		while (batch_len == 0 && !idle_expired)
+			if (reactor_run(&loop) < 0)
+				break;
+		timer_cancel(&loop, &idle);
+		if (batch_len == 0)
+			return NULL;
+	}
+
+	msg *r = batch[batch_pos];
+	batch[batch_pos++] = NULL;
 	return r;
-}	
+}
 
 /*
- * Function utilized to correcly receive a message from the sender
- * Acknoledgement messages are sent back accordingly
- */ 
-msg* receive(int seq)
+ * Function that keeps the FEC symbol of a packet accepted into the window
+ */
+void fec_store(unsigned int abs, msg* r)
 {
-        msg *r = check_timeout();
+	int i = abs % FEC_SLOTS;
+	frame f;
 
-        while (check_crc(r) < 0) {
-        	send_nak(seq);
-                r = check_timeout();
-        }
+	parse_packet(r, &f);
+	fec_sym[i][0] = f.type;
+	fec_sym[i][1] = f.len >> 8;
+	fec_sym[i][2] = f.len & 0xff;
+	memcpy(fec_sym[i] + FEC_HEADER, f.data, f.len);
+	fec_len[i] = FEC_HEADER + f.len;
+	fec_abs[i] = abs;
+}
+
+/*
+ * Function that rebuilds the missing packets of a block from its parity and
+ * acknowledges them as if they had arrived. If too many are missing after
+ * the last parity packet they are asked for now, instead of waiting for the
+ * next gap to be noticed.
+ */
+void fec_repair(fec_block* b, int last)
+{
+	unsigned char *sym[FEC_MAX_N], *rebuilt[FEC_MAX_N], *parity[FEC_MAX_K];
+	int sym_len[FEC_MAX_N], rows[FEC_MAX_K];
+	int nrows = 0;
+
+	for (int j = 0; j < fec_k; ++j)
+		if (b->rows & (1u << j)) {
+			rows[nrows] = j;
+			parity[nrows++] = b->parity[j];
+		}
+
+	for (int i = 0; i < b->n; ++i) {
+		int s = (b->start + i) % FEC_SLOTS;
+		sym[i] = fec_abs[s] == b->start + i ? fec_sym[s] : NULL;
+		sym_len[i] = fec_len[s];
+		rebuilt[i] = fec_sym[s];
+	}
+
+	unsigned long long start = now_us();
+	int m = fec_recover(b->n, sym, sym_len, nrows, rows, parity, b->len,
+			    rebuilt);
+	stats.fec_us += now_us() - start;
+	if (m < 0 && !last)
+		return;
+
+	for (int i = 0; i < b->n; ++i) {
+		unsigned int abs = b->start + i;
+		msg **held = &window[abs % WINDOW_SLOTS];
+		if (sym[i] != NULL || abs < rn || abs - rn >= (unsigned int)
+		    window_size || *held != NULL)
+			continue;
+
+		if (m < 0) {
+			if (!nak_sent[abs % WINDOW_SLOTS]) {
+				nak_sent[abs % WINDOW_SLOTS] = 1;
+				nak_at[abs % WINDOW_SLOTS] = now_us();
+				queue_reply(abs % seq_mod, TYPE_N);
+			}
+			continue;
+		}
+
+		int s = abs % FEC_SLOTS;
+		int len = fec_sym[s][1] << 8 | fec_sym[s][2];
+		fec_abs[s] = abs;
+		fec_len[s] = b->len;
+		if (len > b->len - FEC_HEADER)
+			continue;
+
+		*held = msg_acquire();
+		encode_packet(*held, abs % seq_mod, fec_sym[s][0],
+			      fec_sym[s] + FEC_HEADER, len);
+		held_at[abs % WINDOW_SLOTS] = now_us();
+		nak_at[abs % WINDOW_SLOTS] = 0;
+		queue_ack(*held, 1);
+		stats.fec_repairs++;
+	}
+
+	if (m < 0)
+		stats.fec_failures++;
+}
+
+/*
+ * Function that keeps a parity packet and repairs its block with it
+ */
+void fec_parity(msg* r)
+{
+	frame f;
+	parse_packet(r, &f);
+	stats.fec_parity++;
+
+	if (f.len < 2 + FEC_HEADER)
+		return;
+	int j = f.data[0], n = f.data[1], len = f.len - 2;
+	if (j >= fec_k || n < 1 || n > fec_n)
+		return;
+
+	//the block may start before rn, by less than a window
+	int gap = (f.seq - (int) (rn % seq_mod) + seq_mod) % seq_mod;
+	if (gap >= seq_mod / 2)
+		gap -= seq_mod;
+	unsigned int start = rn + gap;
+
+	if (start + n > fec_covered)
+		fec_covered = start + n;
+	if (start + n <= rn)
+		return;
+
+	fec_block *b = NULL, *oldest = &fec_blocks[0];
+	for (int i = 0; i < FEC_BLOCKS; ++i) {
+		if (fec_blocks[i].start == start && fec_blocks[i].n == n &&
+		    fec_blocks[i].len == len)
+			b = &fec_blocks[i];
+		if (fec_blocks[i].start < oldest->start)
+			oldest = &fec_blocks[i];
+	}
+	if (b == NULL) {
+		b = oldest;
+		b->start = start;
+		b->n = n;
+		b->len = len;
+		b->rows = 0;
+	}
+	if (b->rows & (1u << j))
+		return;
+
+	memcpy(b->parity[j], f.data + 2, len);
+	b->rows |= 1u << j;
+	fec_repair(b, j == fec_k - 1);
+}
+
+/*
+ * Function that receives the next packet in order, stop-and-wait being a
+ * window of one. Every correct packet inside the window is acknowledged
+ * individually and kept until the packets before it arrive and the disk
+ * stage has room for it; duplicates are acknowledged again and dropped.
+ * Packets are drained from the socket in batches whose replies go out
+ * together. Returns NULL if no SEND-INIT came in a few timeouts, or if the
+ * sender stays silent for longer than RTO_MAX later on, or restarts.
+ */
+msg* receive_window()
+{
+	int waited = 0;
+
+	while (1) {
+		msg **held = &window[rn % WINDOW_SLOTS];
+		if (*held != NULL && !ring_room(&stage))
+			stage_wait(0);
+		if (*held != NULL) {
+			msg *r = *held;
+			*held = NULL;
+			nak_sent[rn % WINDOW_SLOTS] = 0;
+			stats_record(&stats.queue_delay,
+				     now_us() - held_at[rn % WINDOW_SLOTS]);
+			rn++;
+			if (batch_pos == batch_len)
+				flush_replies();
+			return r;
+		}
+
+		//a second request for the same packet makes its reply ambiguous
+		msg *r = next_packet();
+		if (r == NULL) {
+			stats.timeouts++;
+			//before the SEND-INIT there is no one to ask
+			if (rn == RN_FIRST) {
+				if (++waited == 3)
+					return NULL;
+				continue;
+			}
+			//a live sender retransmits at least every RTO_MAX
+			if (now_us() - heard_at > RTO_MAX)
+				return NULL;
+			rtt_backoff(&rtt);
+			nak_at[rn % WINDOW_SLOTS] = 0;
+			send_nak(rn % seq_mod);
+			continue;
+		}
+		heard_at = now_us();
+		if (check_crc(r) < 0) {
+			//a corrupt packet is an erasure parity may still fill
+			if (!fec_k || rn < fec_covered) {
+				nak_at[rn % WINDOW_SLOTS] = 0;
+				queue_reply(rn % seq_mod, TYPE_N);
+			}
+			msg_release(r);
+			continue;
+		}
+
+		if (fec_k && r->payload[3] == TYPE_P) {
+			fec_parity(r);
+			msg_release(r);
+			continue;
+		}
+
+		//a SEND-INIT of another session: the sender started over and
+		//waits for a receiver that has not seen its old packets
+		if (rn != RN_FIRST && r->payload[3] == TYPE_S) {
+			frame f;
+			s_data d;
+			parse_packet(r, &f);
+			parse_s(&f, &d);
+			if (s_session(&d) != session_sid) {
+				restarted = 1;
+				msg_release(r);
+				return NULL;
+			}
+		}
+
+		int seq = (unsigned char) r->payload[2];
+		int ahead = (seq - (int) (rn % seq_mod) + seq_mod) % seq_mod;
+
+		if (ahead < window_size) {
+			held = &window[(rn + ahead) % WINDOW_SLOTS];
+			queue_ack(r, *held == NULL);
+			if (*held != NULL) {
+				stats.duplicates++;
+				msg_release(r);
+				continue;
+			}
+			*held = r;
+			held_at[(rn + ahead) % WINDOW_SLOTS] = now_us();
+			if (fec_k)
+				fec_store(rn + ahead, r);
+
+			//a packet requested exactly once measures the RTT
+			unsigned long long *asked = &nak_at[(rn + ahead) %
+							    WINDOW_SLOTS];
+			if (*asked != 0)
+				rtt_sample(&rtt, now_us() - *asked);
+			*asked = 0;
 
-        send_ack(seq);
-        return r;
+			//ask once for every packet missing before this one
+			for (int i = 0; i < ahead; ++i) {
+				unsigned int abs = rn + i;
+				//the parity of its block may still rebuild it
+				if (fec_k && abs >= fec_covered)
+					continue;
+				if (window[abs % WINDOW_SLOTS] == NULL &&
+				    !nak_sent[abs % WINDOW_SLOTS]) {
+					nak_sent[abs % WINDOW_SLOTS] = 1;
+					nak_at[abs % WINDOW_SLOTS] = now_us();
+					queue_reply(abs % seq_mod, TYPE_N);
+				}
+			}
+		} else {
+			//already delivered, the acknowledgement was lost
+			if (ahead >= seq_mod - window_size) {
+				stats.duplicates++;
+				queue_ack(r, 0);
+			}
+			msg_release(r);
+		}
+	}
 }
 
 /*
  * Function that creates a file based on the information received in the 
  * file header 'F' package
  */
-int create_file(msg* r, char *name)
+int create_file(frame* f, char *name)
 {
-        int filename_len = r->len - H_LEN - T_LEN;
-        char *filename = malloc(filename_len * sizeof(char));
-        memcpy(filename, r->payload + H_LEN, filename_len);
-
-        char recv_filename[strlen(RECV_FILE_PREFIX) + filename_len];
-        strcpy(recv_filename, RECV_FILE_PREFIX);
-        strcat(recv_filename, filename);
+        file_name(f, name);
 
         mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-	
-	memcpy(name, recv_filename, strlen(RECV_FILE_PREFIX) + filename_len);
-        return open(recv_filename, O_WRONLY | O_CREAT, mode);
+        return open(name, O_WRONLY | O_CREAT, mode);
 }
 
-/* 
- * Function that writes the content of a data 'D' package into the appropriate
- * file
+/*
+ * Function that creates a file of an archive under the receiver's prefix,
+ * along with the directories on its path; names that climb out of them are
+ * refused. Returns the descriptor, -1 on error.
  */
-void write_data(msg* r, int fd)
+int create_member(const char* name, int mode)
 {
-        int data_len = r->len - H_LEN - T_LEN;
+        static char path[sizeof(RECV_FILE_PREFIX) + ARCHIVE_NAME_MAX];
+        int len = strlen(name);
+
+        if (strstr(name, "/../") != NULL ||
+            (len >= 3 && strcmp(name + len - 3, "/..") == 0))
+                return -1;
 
-        char* data = malloc(data_len * sizeof(char));
-        memcpy(data, r->payload + H_LEN, data_len);
+        sprintf(path, "%s%s", RECV_FILE_PREFIX, name);
+        for (char *p = strchr(path, '/'); p != NULL; p = strchr(p + 1, '/')) {
+                *p = '\0';
+                mkdir(path, 0755);
+                *p = '/';
+        }
 
-        write(fd, data, data_len);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd >= 0)
+                fchmod(fd, mode & 0777);
+        return fd;
+}
+
+/*
+ * Function that adds a byte to the header of the next file of an archive;
+ * once the name is complete the file is created and the data that follows
+ * goes to it. An empty name ends the archive.
+ */
+void unpack_byte(unsigned char b)
+{
+        archive_header h;
+
+        if (unpack.done)
+                return;
+        unpack.header[unpack.header_len++] = b;
+        if (unpack.header_len < (int) sizeof(h))
+                return;
+
+        memcpy(&h, unpack.header, sizeof(h));
+        if (h.name_len == 0 || h.name_len > ARCHIVE_NAME_MAX) {
+                writer_file(&out, -1);
+                unpack.done = 1;
+                return;
+        }
+        if (unpack.header_len < (int) sizeof(h) + h.name_len)
+                return;
+
+        char name[ARCHIVE_NAME_MAX + 1];
+        memcpy(name, unpack.header + sizeof(h), h.name_len);
+        name[h.name_len] = '\0';
+        int fd = create_member(name, h.mode);
+        if (fd < 0)
+                printf("=== File %s%s could not be created ===\n",
+                       RECV_FILE_PREFIX, name);
+
+        //the writer's thread closes the file once its data is written
+        writer_file(&out, fd);
+        unpack.remaining = h.size;
+        unpack.header_len = 0;
+        unpack.files++;
+}
+
+/*
+ * Function that splits decoded archive data between the headers and the
+ * files they announce
+ */
+void unpack_write(const unsigned char* data, int len)
+{
+        while (len > 0) {
+                if (unpack.remaining == 0) {
+                        unpack_byte(*data++);
+                        len--;
+                        continue;
+                }
+                int n = unpack.remaining < (unsigned long long) len ?
+                        (int) unpack.remaining : len;
+                writer_write(&out, data, n);
+                unpack.remaining -= n;
+                data += n;
+                len -= n;
+        }
+}
+
+/*
+ * Function that splits an expanded repeat sequence of archive data like
+ * unpack_write()
+ */
+void unpack_fill(unsigned char byte, int count)
+{
+        while (count > 0) {
+                if (unpack.remaining == 0) {
+                        unpack_byte(byte);
+                        count--;
+                        continue;
+                }
+                int n = unpack.remaining < (unsigned long long) count ?
+                        (int) unpack.remaining : count;
+                writer_fill(&out, byte, n);
+                unpack.remaining -= n;
+                count -= n;
+        }
+}
+
+/*
+ * Functions that hand decoded data to the output, through the unpacker when
+ * receiving an archive
+ */
+void put_data(const unsigned char* data, int len)
+{
+        if (archive)
+                unpack_write(data, len);
+        else
+                writer_write(&out, data, len);
+}
+
+void put_run(unsigned char byte, int count)
+{
+        if (archive)
+                unpack_fill(byte, count);
+        else
+                writer_fill(&out, byte, count);
+}
+
+/*
+ * Function that writes the run of blocks of the old copy that a delta
+ * refers to: the index of the first one and their number
+ */
+void copy_blocks(const unsigned char* copy)
+{
+        int index;
+        memcpy(&index, copy, sizeof(index));
+        long long len = (long long) copy[4] * basis_block;
+
+        if (writer_copy(&out, basis_fd, (long long) index * basis_block,
+                        len) == 0) {
+                stats_add(&stats.goodput_bytes, len);
+                stats_add(&stats.delta_copied, len);
+        }
 }
 
 /* 
- * Increment sequence number modulo mod
- */ 
-int increment_seq(int seq, int mod) 
+ * Function that writes the content of a data 'D' package into the output
+ * buffer, expanding repeat-count sequences if a prefix was negotiated
+ */
+void write_data(frame* f)
 {
-	return (seq + 1) % mod;
+        int data_len = f->len;
+        unsigned char* data = f->data;
+
+        if (!rept.prefix) {
+                put_data(data, data_len);
+                stats_add(&stats.goodput_bytes, data_len);
+                return;
+        }
+
+        int start = 0;
+        for (int i = 0; i < data_len; ++i) {
+                switch (rept.state) {
+                        case REPT_COUNT:
+                                rept.count = data[i];
+                                rept.copied = 0;
+                                //a zero count starts a block reference
+                                rept.state = rept.count == 0 &&
+                                             basis_fd >= 0 ?
+                                             REPT_COPY : REPT_BYTE;
+                                break;
+                        case REPT_COPY:
+                                rept.copy[rept.copied++] = data[i];
+                                if (rept.copied == DELTA_COPY) {
+                                        copy_blocks(rept.copy);
+                                        rept.state = REPT_LITERAL;
+                                        start = i + 1;
+                                }
+                                break;
+                        case REPT_BYTE:
+                                put_run(data[i], rept.count);
+                                stats_add(&stats.goodput_bytes, rept.count);
+                                rept.state = REPT_LITERAL;
+                                start = i + 1;
+                                break;
+                        default:
+                                if (data[i] == rept.prefix) {
+                                        //literals before the prefix
+                                        put_data(data + start, i - start);
+                                        stats_add(&stats.goodput_bytes,
+                                                  i - start);
+                                        rept.state = REPT_COUNT;
+                                }
+                                break;
+                }
+        }
+
+        if (rept.state == REPT_LITERAL && start < data_len) {
+                put_data(data + start, data_len - start);
+                stats_add(&stats.goodput_bytes, data_len - start);
+        }
 }
 
-int main(int argc, char** argv) 
+/*
+ * Function that starts receiving a delta, announced by the block size in an
+ * 'A' package: the old copy stays open for the blocks the delta refers to
+ * and the new one is written next to it, replacing it at EOF.
+ * Returns -1 if either cannot be opened.
+ */
+int delta_file(frame* f, int* fd, char* name)
+{
+        long long block = attr_get(f, ATTR_BLOCK);
+        if (block < DELTA_MIN_BLOCK || block > DELTA_MAX_BLOCK)
+                return 0;
+
+        writer_close(&out);
+        close(*fd);
+        sprintf(part_name, "%s%s", name, DELTA_SUFFIX);
+        mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+        *fd = open(part_name, O_WRONLY | O_CREAT | O_TRUNC, mode);
+        basis_fd = open(name, O_RDONLY);
+        basis_block = block;
+        if (*fd < 0 || basis_fd < 0)
+                return -1;
+
+        writer_open(&out, *fd);
+        printf("=== Receiving %s as a delta of %lld-byte blocks ===\n\n",
+               name, block);
+        return 0;
+}
+
+/*
+ * Function that checks the delta just written against the size and CRC of
+ * the whole file the 'Z' package carries; one from a sender that sends none
+ * is taken as it is
+ */
+int delta_matches(frame* f, long long size)
 {
-    	init(HOST, PORT);
-	
-	int seq = 0;
+        long long check = attr_get(f, ATTR_CHECK);
+        unsigned int crc;
 
-	//receive init package
-	msg* r = receive_s(seq);	
-	if (r == NULL) {
-		printf("=== Unable to establish connection ===\n\n");
-		printf("  ##### ABORTING TRANSMISSION. #####\n");	 
-		return 0;
-	}
-	
-	seq = increment_seq(seq, MODULO_SEQ);
+        if (check < 0)
+                return 1;
+        int fd = open(part_name, O_RDONLY);
+        int ok = fd >= 0 && attr_get(f, ATTR_LENGTH) == size &&
+                 file_crc(fd, size, &crc) == 0 && crc == check;
+        if (fd >= 0)
+                close(fd);
+        return ok;
+}
 
-	int fd;
-	char *filename = malloc(MAXL * sizeof(char));
+/*
+ * Function that reserves the disk space of a file whose size is announced in
+ * an 'A' package; the file size itself is left alone
+ */
+void allocate_file(frame* f, int fd)
+{
+        long long size = attr_get(f, ATTR_LENGTH);
+        if (size > 0)
+                fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+}
 
-	//until the received package is EOT ('B'), receive the other packages
-	while (r->payload[3] != TYPE_B) {
-		r = receive(seq); 	
-		seq = increment_seq(seq, MODULO_SEQ);
-		
+/*
+ * Function that moves the output past the part of the file the sender
+ * agreed to resume after, as announced in an 'A' package
+ */
+void resume_file(frame* f, int fd, char* name)
+{
+        long long offset = attr_get(f, ATTR_OFFSET);
+        if (offset <= 0)
+                return;
+
+        writer_close(&out);
+        lseek(fd, offset, SEEK_SET);
+        writer_open(&out, fd);
+        printf("=== Resuming %s at byte %lld ===\n\n", name, offset);
+}
+
+/*
+ * Disk stage: decodes the packets the network thread delivers, in order,
+ * and writes their data, until EOT or until the network thread gives up
+ * (E). Whenever it waits KIO_IDLE_MS for a packet, what it wrote so far is
+ * flushed, so everything acknowledged reaches the file even if the
+ * receiver is killed.
+ */
+void* disk_stage(void* arg)
+{
+	int fd = -1;
+	//names are carried in a single packet, so they fit a long one
+	char *filename = malloc((strlen(RECV_FILE_PREFIX) + MAXLX + 1) *
+				sizeof(char));
+	char type;
+
+	do {
+		msg* r;
+		while ((r = ring_front(&stage, KIO_IDLE_MS)) == NULL)
+			writer_flush(&out);
+
+		frame f;
+		parse_packet(r, &f);
+		type = f.type;
 		
-		switch (r->payload[3]) {
+		switch (type) {
 			case TYPE_F: 
-				fd = create_file(r, filename);
+				rept.state = REPT_LITERAL;
+				if (archive) {
+					printf("=== Unpacking %.*s ===\n\n",
+					       f.len, f.data);
+					memset(&unpack, 0, sizeof(unpack));
+					writer_open_files(&out);
+					break;
+				}
+				if (stream) {
+					printf("=== Stream %.*s written to"
+					       " stdout ===\n\n", f.len, f.data);
+					writer_open(&out, out_fd);
+					break;
+				}
+				fd = create_file(&f, filename);
+				writer_open(&out, fd);
 				if (fd > 0) 
 					printf("=== File %s created"
 					       " successfully ===\n\n",
@@ -279,20 +1108,212 @@ int main(int argc, char** argv)
 					       " created === \n\n", filename);
 					printf(" ##### ABORTING" 
 					       "TRASMISSION. #####\n");
-					return 0;
+					exit(0);
+				}
+				break;
+			case TYPE_A:
+				if (!stream && delta &&
+				    delta_file(&f, &fd, filename) < 0) {
+					printf("=== Delta of %s could not be"
+					       " opened ===\n\n", filename);
+					printf(" ##### ABORTING"
+					       " TRASMISSION. #####\n");
+					exit(0);
+				}
+				if (!stream) {
+					allocate_file(&f, fd);
+					resume_file(&f, fd, filename);
 				}
 				break;
 			case TYPE_D:
-				write_data(r, fd);	
+				write_data(&f);	
 				break;
 			case TYPE_Z:
-				close(fd);
+				if (archive) {
+					writer_file(&out, -1);
+					printf("=== %d files unpacked ===\n\n",
+					       unpack.files);
+				}
+				if (writer_flush(&out) < 0)
+					printf("=== Error writing %s ===\n\n",
+					       archive ? "the archive" :
+					       stream ? "stdout" : filename);
+				writer_close(&out);
+				if (!stream && !archive) {
+					//drop what a longer old file left
+					ftruncate(fd, out.offset);
+					close(fd);
+				}
+				//the delta is complete, it replaces the copy
+				//unless a block matched by its hashes differs
+				if (basis_fd >= 0) {
+					close(basis_fd);
+					basis_fd = -1;
+					if (delta_matches(&f, out.offset)) {
+						rename(part_name, filename);
+					} else {
+						unlink(part_name);
+						printf("=== Delta of %s does"
+						       " not match, the copy is"
+						       " kept ===\n\n", filename);
+					}
+				}
+				break;
+			case TYPE_E:
+				//what was received stays for a resume; a delta
+				//is left in its part file
+				writer_close(&out);
+				if (!stream && !archive && fd >= 0)
+					close(fd);
+				if (basis_fd >= 0) {
+					close(basis_fd);
+					basis_fd = -1;
+				}
 				break;
 			default:
 				break;
 		}
+		ring_pop(&stage);
+	} while (type != TYPE_B && type != TYPE_E);
+
+	free(filename);
+	return NULL;
+}
+
+int main(int argc, char** argv) 
+{
+	//ports of the links the sender stripes its packets over
+	int ports[MAX_PATHS];
+	int nports = 0;
+	int serving = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:D")) != -1) {
+		switch (opt) {
+			case 'D':
+				serving = 1;
+				break;
+			case 'p':
+				for (char *t = strtok(optarg, ","); t != NULL;
+				     t = strtok(NULL, ",")) {
+					if (nports == MAX_PATHS) {
+						printf("At most %d paths\n",
+						       MAX_PATHS);
+						return 1;
+					}
+					ports[nports++] = atoi(t);
+				}
+				break;
+			default:
+				printf("Usage: %s [-p port,...] [-D | -]\n",
+				       argv[0]);
+				return 1;
+		}
+	}
+
+	//"-" sends the data to stdout and the messages below to stderr
+	if (!serving && optind < argc && strcmp(argv[optind], "-") == 0) {
+		stream = 1;
+		out_fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+
+	if (nports == 0)
+		ports[nports++] = PORT;
+	set_block_check(CHKT_CRC16);
+	if (serving) {
+		//every link is a sender of its own, served by a session of one
+		//path that starts from the SEND-INIT the daemon received
+		batch[0] = msg_acquire();
+		if (serve(HOST, ports, nports, batch[0]) < 0) {
+			printf("=== Unable to start the server ===\n");
+			return 1;
+		}
+		batch_len = npaths = 1;
+	} else {
+		for (npaths = 0; npaths < nports; ++npaths)
+			add_path(HOST, ports[npaths]);
+	}
+	rtt_init(&rtt, TIME);
+	stats_open("receiver");
+
+	if (reactor_open(&loop) < 0 || ring_open(&stage) < 0) {
+		printf("=== Unable to start the event loop ===\n");
+		return 1;
+	}
+	for (int i = 0; i < npaths; ++i) {
+		path_watch[i].fd = path_fd(i);
+		path_watch[i].fn = socket_readable;
+		path_watch[i].arg = &path_watch[i];
+		reactor_add(&loop, &path_watch[i]);
+	}
+	stage_watch.fd = stage.room_fd;
+	stage_watch.fn = stage_readable;
+	stage_watch.arg = NULL;
+	reactor_add(&loop, &stage_watch);
+	timer_init(&idle, idle_timeout, NULL);
+
+	//receive init package, in a window of one until it is accepted
+	msg* r = receive_window();
+	if (r == NULL) {
+		printf("=== Unable to establish connection ===\n\n");
+		printf("  ##### ABORTING TRANSMISSION. #####\n");	 
+		return 0;
+	}
+	msg_release(r);
+
+	if (window_size > 1)
+		printf("=== Sliding window of %d packets ===\n", window_size);
+	if (rept.prefix)
+		printf("=== Repeat prefix '%c' ===\n", rept.prefix);
+	if (fec_k)
+		printf("=== FEC: %d parity per %d packets ===\n", fec_k, fec_n);
+	if (npaths > 1)
+		printf("=== Listening on %d paths ===\n", npaths);
+
+	part_name = malloc((strlen(RECV_FILE_PREFIX) + MAXLX +
+			    sizeof(DELTA_SUFFIX)) * sizeof(char));
+	if (pthread_create(&disk, NULL, disk_stage, NULL) != 0) {
+		printf("=== Unable to start the disk stage ===\n");
+		return 1;
+	}
+
+	//until the received package is EOT ('B'), hand the packages over
+	char type;
+	do {
+		r = receive_window();
+		stats_tick();
+		if (r == NULL) {
+			//the disk stage closes the file with what it has
+			msg e;
+			encode_packet(&e, 0, TYPE_E, "", 0);
+			if (!ring_room(&stage))
+				stage_wait(0);
+			ring_push(&stage, &e);
+			break;
+		}
+		type = r->payload[3];
+		ring_push(&stage, r);
+		msg_release(r);
+	} while (type != TYPE_B);
+	flush_replies();
+	pthread_join(disk, NULL);
+
+	for (int i = 0; i < MAX_BATCH; ++i)
+		msg_release(batch[i]);
+	stats_dump("eot");
+	reactor_close(&loop);
+	ring_close(&stage);
+
+	if (msg_outstanding() != 0)
+		printf("[leak] %d buffers outstanding\n", msg_outstanding());
+
+	if (r == NULL) {
+		printf(restarted ? "=== The sender started over ===\n\n" :
+		       "=== Transmission experienced timeout ===\n\n");
+		printf("  ##### ABORTING TRANSMISSION. #####\n");
+		return 1;
 	}
-	
 	printf ("\n  ##### TRANSMISSION ENDED SUCCESSFULY. #####\n"); 		
 	return 0;
 }
@@ -0,0 +1,132 @@
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "kring.h"
+
+/*
+ * Function that starts an empty ring. Returns -1 if its eventfds cannot
+ * be created.
+ */
+int ring_open(packet_ring* r)
+{
+	r->head = r->tail = 0;
+	r->consumer_waiting = r->producer_waiting = 0;
+	r->filled_fd = eventfd(0, EFD_CLOEXEC);
+	r->room_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (r->filled_fd < 0 || r->room_fd < 0) {
+		ring_close(r);
+		return -1;
+	}
+	return 0;
+}
+
+void ring_close(packet_ring* r)
+{
+	if (r->filled_fd >= 0)
+		close(r->filled_fd);
+	if (r->room_fd >= 0)
+		close(r->room_fd);
+	r->filled_fd = r->room_fd = -1;
+}
+
+/*
+ * Function that wakes the other side if it sleeps on waiting; the flags
+ * and indices are sequentially consistent, so either the sleeper sees the
+ * index that moved or the mover sees the flag
+ */
+static void ring_wake(int* waiting, int fd)
+{
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) &&
+	    __atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST)) {
+		unsigned long long one = 1;
+		write(fd, &one, sizeof(one));
+	}
+}
+
+/*
+ * Function that tells the producer whether a packet can be pushed. If the
+ * ring is full, room_fd is signalled once the consumer frees a slot.
+ */
+int ring_room(packet_ring* r)
+{
+	if (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) < RING_SLOTS)
+		return 1;
+
+	__atomic_store_n(&r->producer_waiting, 1, __ATOMIC_SEQ_CST);
+	if (r->head - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) < RING_SLOTS) {
+		__atomic_store_n(&r->producer_waiting, 0, __ATOMIC_SEQ_CST);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Function that tells the producer whether the consumer is done with every
+ * packet pushed. If not, room_fd is signalled once it pops the next one.
+ */
+int ring_drained(packet_ring* r)
+{
+	if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->head)
+		return 1;
+
+	__atomic_store_n(&r->producer_waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == r->head) {
+		__atomic_store_n(&r->producer_waiting, 0, __ATOMIC_SEQ_CST);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Function that copies a packet into the ring, which must have room
+ */
+void ring_push(packet_ring* r, const msg* m)
+{
+	msg* s = &r->slot[r->head % RING_SLOTS];
+
+	s->len = m->len;
+	memcpy(s->payload, m->payload, m->len);
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_SEQ_CST);
+	ring_wake(&r->consumer_waiting, r->filled_fd);
+}
+
+/*
+ * Function that returns the oldest packet of the ring, sleeping until
+ * there is one; it stays there until ring_pop(). Returns NULL if none
+ * came within timeout millis, a negative one waiting forever.
+ */
+msg* ring_front(packet_ring* r, int timeout)
+{
+	while (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail) {
+		__atomic_store_n(&r->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) != r->tail) {
+			__atomic_store_n(&r->consumer_waiting, 0,
+					 __ATOMIC_SEQ_CST);
+			break;
+		}
+		struct pollfd p = { r->filled_fd, POLLIN, 0 };
+		if (poll(&p, 1, timeout) == 0) {
+			//a push racing this sees no sleeper or leaves a wakeup
+			__atomic_store_n(&r->consumer_waiting, 0,
+					 __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) ==
+			    r->tail)
+				return NULL;
+			break;
+		}
+		//a wakeup left over from an earlier wait only loops again
+		unsigned long long count;
+		read(r->filled_fd, &count, sizeof(count));
+	}
+	return &r->slot[r->tail % RING_SLOTS];
+}
+
+/*
+ * Function that hands the oldest packet's slot back to the producer
+ */
+void ring_pop(packet_ring* r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_SEQ_CST);
+	ring_wake(&r->producer_waiting, r->room_fd);
+}
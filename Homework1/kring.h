@@ -0,0 +1,43 @@
+#ifndef KRING
+#define KRING
+
+#include "lib.h"
+
+/*
+ * Lock-free ring of packets between two threads, one producing and one
+ * consuming. Packets are copied into the slots, so buffers never change
+ * threads; each side only writes its own index and reads the other's. A
+ * full ring is the back-pressure on the producer, who keeps its packets
+ * and is told through room_fd when a slot is freed; a consumer finding
+ * the ring empty sleeps on an eventfd. Syscalls are only made by a side
+ * that found the ring full or empty.
+ */
+
+#define RING_SLOTS 256
+#define RING_LINE 64
+
+typedef struct {
+	msg slot[RING_SLOTS];
+
+	//packets pushed by the producer and popped by the consumer, on
+	//cache lines of their own
+	unsigned int head __attribute__((aligned(RING_LINE)));
+	unsigned int tail __attribute__((aligned(RING_LINE)));
+
+	//set by a side about to sleep, cleared by the other as it wakes it
+	int consumer_waiting __attribute__((aligned(RING_LINE)));
+	int producer_waiting;
+	//eventfd the consumer sleeps on, and the one that tells the producer
+	//about room, which it polls
+	int filled_fd, room_fd;
+} packet_ring;
+
+int ring_open(packet_ring* r);
+void ring_close(packet_ring* r);
+int ring_room(packet_ring* r);
+int ring_drained(packet_ring* r);
+void ring_push(packet_ring* r, const msg* m);
+msg* ring_front(packet_ring* r, int timeout);
+void ring_pop(packet_ring* r);
+
+#endif
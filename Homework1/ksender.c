@@ -5,279 +5,1326 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "lib.h"
 #include "klib.h"
+#include "kcodec.h"
+#include "kstats.h"
+#include "kio.h"
+#include "kfec.h"
+#include "kdelta.h"
+#include "kreactor.h"
+#include "kcong.h"
+#include "ksize.h"
+#include "kpath.h"
 
 #define HOST "127.0.0.1"
 #define PORT 10000
 
+/*
+ * A packet held in the sliding window until the receiver acknowledges it,
+ * with its absolute number and its retransmission timer
+ */
+typedef struct {
+	msg m;
+	unsigned int abs;
+	ktimer timer;
+	int acked;
+	int tries;
+	int sent;
+	unsigned long long sent_at;
+	unsigned long long first_at;
+	//when the parity of its FEC block left, since the receiver may wait
+	//for it before acknowledging
+	unsigned long long fec_at;
+	//length of the D packets it was filled to, -1 for other packets
+	int size;
+	//path it was last sent on, -1 before it is sent, and its place in
+	//the order of that path
+	int path;
+	unsigned long long order;
+} slot;
+
+slot window[WINDOW_SLOTS];
+int window_size = 1;
+
+//links the packets are striped over, each with its RTT estimate and the
+//congestion window that bounds the packets in flight on it
+kpath paths[MAX_PATHS];
+int npaths;
+int cong_mode = CONG_AIMD;
+int seq_mod = MODULO_SEQ;
+
+//data bytes carried by each D packet at most
+int maxl = MAXL;
+
+//length of the D packets, picked from how often they fail
+size_control sizes;
+
+//repeat prefix agreed with the receiver, 0 if data is sent raw
+unsigned char rept = REPT;
+
+//set if the receiver accepts 'A' packets
+int attributes;
+
+//set if files are resumed from the copy the receiver already holds
+int resume;
+
+//set if files are sent as deltas against the copy the receiver holds
+int delta;
+
+//acknowledgement of the last 'F' packet, which carries what the receiver
+//holds of the file when resuming or sending deltas
+msg file_reply;
+
+//signatures of the receiver's copy of the file being sent as a delta
+delta_index basis;
+
+//set if all the files are sent as one archive
+int archive;
+
+//FEC block size and parity packets per block, 0 if FEC is off
+int fec_n, fec_k;
+fec_encoder fec;
+msg fec_out[FEC_MAX_K];
+
+/*
+ * Repeat-count encoder state: the run of identical bytes not yet emitted,
+ * which may continue across reads and packets
+ */
+typedef struct {
+	unsigned char byte;
+	int count;
+} rept_encoder;
+
+/*
+ * Delta encoder state over the mapped file: the window being checked starts
+ * at pos, whose weak checksum is kept while rolled is set; the literals
+ * before it start at lit. A run of consecutive blocks is referenced once it
+ * is closed by literals or by a block that does not continue it; match is a
+ * block found at pos and not yet added to a run.
+ */
+typedef struct {
+	const unsigned char* map;
+	long long size, pos, lit;
+	unsigned int weak;
+	int rolled;
+	int run_block, run_count, run_closed;
+	int match;
+} delta_encoder;
+
+/*
+ * Input file or stream being packetized, read ahead or, for a delta, mapped
+ */
+typedef struct {
+	reader in;
+	int done;
+	rept_encoder rept;
+	delta_encoder delta;
+} source;
+
+//absolute numbers of the oldest unacknowledged and of the next packet; the
+//SEND-INIT is the first, and they match sequence numbers modulo either space
+unsigned int base = MODULO_SEQ_EXT, next = MODULO_SEQ_EXT;
+
+//event loop every wait goes through, watching the socket and the input
+reactor loop;
+kwatch input_watch;
+
+//set once a packet timed out too many times
+int window_failed;
+
+//acknowledgement of the SEND-INIT, carrying the receiver's parameters
+msg init_reply;
+
+//replies drained from the socket in one call
+msg replies[MAX_BATCH];
+msg* reply_bufs[MAX_BATCH];
+
 /*
  * Function that creates the inital 'S' package
  */
-unsigned char* create_s(int seq)
+void create_s(msg* m, int seq, int windo, int maxlx, int rept_prefix,
+	      int fecn, int feck, int resend, int deltas, int archiving,
+	      char chkt)
 {       
-	unsigned char* buffer = malloc(S_LEN * sizeof(unsigned char));
-	s_pkg s;
+	s_data d;
 
-        s.h.soh = SOH;
-        s.h.len = S_LEN - 2;
-        s.h.seq = seq;
-        s.h.type = TYPE_S;
+        d.maxl = MAXL;
+        d.time = rtt_time_field(&paths[0].rtt);
+        d.npad = NPAD;
+        d.padc = PADC;
+        d.eol = EOL;
+        d.qctl = QCTL;
+        d.qbin = QBIN;
+        d.chkt = chkt;
+        d.rept = rept_prefix;
+        d.capa = CAPA | CAPA_AT;
+        if (resend)
+                d.capa |= CAPA_RESEND;
+        //copies are escaped with the repeat prefix
+        if (deltas && rept_prefix)
+                d.capa |= CAPA_DELTA;
+        if (archiving)
+                d.capa |= CAPA_ARCHIVE;
+        if (windo > 1)
+                d.capa |= CAPA_SWS;
+        if (maxlx > MAXL)
+                d.capa |= CAPA_LP;
+        d.r = R;
+        d.windo = windo;
+        d.maxlx1 = maxlx >> 8;
+        d.maxlx2 = maxlx & 0xff;
+        //parity only makes sense with a window to recover into
+        d.fecn = windo > 1 ? fecn : 0;
+        d.feck = windo > 1 ? feck : 0;
+        //tells this transfer from others coming through the same link
+        unsigned int sid = (getpid() ^ now_us()) | 1;
+        d.sid[0] = sid >> 24;
+        d.sid[1] = sid >> 16;
+        d.sid[2] = sid >> 8;
+        d.sid[3] = sid;
 
-        s.d.maxl = MAXL;
-        s.d.time = TIME;
-        s.d.npad = NPAD;
-        s.d.padc = PADC;
-        s.d.eol = EOL;
-        s.d.qctl = QCTL;
-        s.d.qbin = QBIN;
-        s.d.chkt = CHKT;
-        s.d.rept = REPT;
-        s.d.capa = CAPA;
-        s.d.r = R;
+        encode_s(m, seq, TYPE_S, &d);
+}
 
-        int crc_len = S_LEN - T_LEN;
-        unsigned char crc_data[crc_len];
-        memcpy(crc_data, &s, crc_len);
+/* 
+ * Increment the sequence number modulo mod 
+ */
+int increment_seq(int seq, int mod) 
+{	
+	return (seq + 1) % mod;
+}
+
+/*
+ * Apply the parameters the receiver accepted in its SEND-INIT acknowledgement
+ */
+void negotiate(msg* r)
+{
+	frame f;
+	s_data d;
+
+	parse_packet(r, &f);
+	parse_s(&f, &d);
+
+	if ((d.capa & CAPA_SWS) && d.windo > 1) {
+		window_size = d.windo < MAX_WINDO ? d.windo : MAX_WINDO;
+		seq_mod = SEQ_SPACE(window_size);
+	}
+
+	//paths the SEND-INIT did not take start from the estimate of the one
+	//it measured; the peer's only matters if the exchange gave no sample
+	rtt_estimator first;
+	rtt_init(&first, d.time);
+	for (int i = 0; i < npaths; ++i)
+		if (paths[i].rtt.srtt != 0)
+			first = paths[i].rtt;
+	for (int i = 0; i < npaths; ++i) {
+		if (paths[i].rtt.srtt == 0)
+			paths[i].rtt = first;
+		cong_init(&paths[i].cong, cong_mode, window_size);
+	}
+
+	//the receiver answers with the block check it picked, CRC16 unless it
+	//knows the one offered
+	set_block_check(d.chkt);
+
+	attributes = d.capa & CAPA_AT;
+	resume = attributes && (d.capa & CAPA_RESEND);
+
+	if (window_size > 1 && d.fecn > 0 && d.feck > 0) {
+		fec_n = d.fecn < window_size ? d.fecn : window_size;
+		if (fec_n > FEC_MAX_N)
+			fec_n = FEC_MAX_N;
+		fec_k = d.feck < FEC_MAX_K ? d.feck : FEC_MAX_K;
+	} else {
+		fec_n = fec_k = 0;
+	}
 
-        s.t.check = crc16_ccitt(crc_data, crc_len);
-        s.t.mark = MARK;
-        memcpy(buffer, &s, S_LEN);
+	//both sides must agree on the same prefix character
+	if (d.rept != rept)
+		rept = REPT;
+	delta = attributes && rept && (d.capa & CAPA_DELTA);
+	archive = d.capa & CAPA_ARCHIVE;
 
-        return buffer;
+	int maxlx = d.maxlx1 << 8 | d.maxlx2;
+	if ((d.capa & CAPA_LP) && maxlx > MAXL) {
+		if (maxlx < maxl)
+			maxl = maxlx;
+	} else if (maxl > short_maxl(codec_chkt)) {
+		maxl = short_maxl(codec_chkt);
+	}
 }
 
 /*
- * Function that creates a file header 'F' package
+ * Function that keeps what the receiver put in the acknowledgement r of s:
+ * its parameters for the SEND-INIT, what it holds of the file for an 'F'
+ * packet or an 'H' one asking after a delta, the signatures of the blocks
+ * asked for by any other 'H'
  */
-unsigned char* create_f(char *filename, int seq)
+void keep_reply(msg* s, msg* r)
 {
-        int header_len = H_LEN + strlen(filename) + T_LEN;
-        unsigned char *buffer = malloc(header_len * sizeof(unsigned char));
+	if (s->payload[3] == TYPE_S) {
+		memcpy(&init_reply, r, sizeof(msg));
+	} else if (s->payload[3] == TYPE_F) {
+		memcpy(&file_reply, r, sizeof(msg));
+	} else if (s->payload[3] == TYPE_H) {
+		frame asked, reply;
+		parse_packet(s, &asked);
+		if (attr_get(&asked, ATTR_BLOCK) < 0) {
+			memcpy(&file_reply, r, sizeof(msg));
+			return;
+		}
+		parse_packet(r, &reply);
+		delta_parse(&basis, attr_get(&asked, ATTR_INDEX), reply.data,
+			    reply.len);
+	}
+}
 
-        header h;
-        h.soh = SOH;
-        h.len = header_len - 2;;
-        h.seq = seq;
-        h.type = TYPE_F;
+/*
+ * Map a sequence number received from the peer to the absolute number of an
+ * outstanding packet. Returns 0 if no packet in the window carries it.
+ */
+unsigned int window_lookup(int seq)
+{
+	unsigned int abs = base + (seq - base % seq_mod + seq_mod) % seq_mod;
+	return abs < next ? abs : 0;
+}
+
+/*
+ * Function that sends the burst of window packets queued on a path
+ */
+void path_send_burst(kpath* p)
+{
+	if (p->burst_len > 0)
+		send_messages_on(p->id, p->burst, p->burst_len);
+	p->burst_len = 0;
+}
 
-        memcpy(buffer, &h, H_LEN);
-        memcpy(buffer + H_LEN, filename, strlen(filename));
+/*
+ * Function that sends the queued bursts of window packets
+ */
+void window_send_burst()
+{
+	for (int i = 0; i < npaths; ++i)
+		path_send_burst(&paths[i]);
+}
+
+/*
+ * Moment the retransmission timer of a packet expires
+ */
+unsigned long long window_deadline(slot* sl)
+{
+	return (sl->fec_at > sl->sent_at ? sl->fec_at : sl->sent_at) +
+	       paths[sl->path].rtt.rto;
+}
 
-        int crc_len = header_len - T_LEN;
-        unsigned char crc_data[crc_len];
-        memcpy(crc_data, buffer, (H_LEN + strlen(filename)));
+/*
+ * Function that queues the packet held in a window slot for (re)transmission
+ * in the next burst of a path: the fastest with room for a first
+ * transmission, the fastest for a retransmission, which is not held back
+ */
+void window_transmit(slot* sl)
+{
+	int i = path_pick(paths, npaths, sl->sent == 0);
+	if (i < 0)
+		i = path_pick(paths, npaths, 0);
+	if (sl->path >= 0)
+		paths[sl->path].inflight--;
+	sl->path = i;
 
-        trailer t;
-        t.check = crc16_ccitt(crc_data, crc_len);
-        t.mark = MARK;
+	kpath *p = &paths[i];
+	p->inflight++;
+	sl->order = ++p->order;
+	path_sent(p);
+	if (p->burst_len == MAX_BATCH)
+		path_send_burst(p);
+	p->burst[p->burst_len++] = &sl->m;
+	sl->sent_at = now_us();
+	timer_arm(&loop, &sl->timer, window_deadline(sl));
+	sl->sent++;
+	size_sent(&sizes, sl->size);
+	stats_sent(sl->m.len);
+	if (sl->sent > 1)
+		stats.retransmits++;
+}
 
-        memcpy(buffer + (header_len - T_LEN), &t, T_LEN);
+/*
+ * Retransmission timer of a window slot: the packet is sent again, the
+ * timeout being backed off once per round of expiries. Gives up once a
+ * packet timed out MAX_TRIES times.
+ */
+void window_expired(void* arg)
+{
+	slot *sl = arg;
+	kpath *p = &paths[sl->path];
 
-        return buffer;
+	sl->tries++;
+	stats.timeouts++;
+	cong_timeout(&p->cong, sl->abs, next);
+	path_failed(p);
+	size_failed(&sizes, sl->size);
+	if (sl->tries >= MAX_TRIES) {
+		window_failed = 1;
+		return;
+	}
+	if (!p->backed_off) {
+		rtt_backoff(&p->rtt);
+		p->backed_off = 1;
+	}
+	window_transmit(sl);
 }
 
-/* 
- * Function that creates a data 'D' package 
- */	
-unsigned char* create_d(unsigned char* data_buffer, int nbytes, int seq)
+/*
+ * Function that handles one reply of the receiver
+ */
+void window_reply(msg* r)
 {
-        header h;
-        h.soh = SOH;
-        h.seq = seq;
-        h.len = nbytes + H_LEN + T_LEN - 2;
-        h.type = TYPE_D;
+	stats_received(r->len);
+	if (check_packet(r) < 0) {
+		stats.crc_failures++;
+		//in a window of one it can only be about the packet in flight
+		if (window_size == 1 && base < next &&
+		    !window[base % WINDOW_SLOTS].acked)
+			window_transmit(&window[base % WINDOW_SLOTS]);
+		return;
+	}
 
-        int crc_len = nbytes + H_LEN;
-        char crc_data[crc_len];
-        memcpy(crc_data, &h, H_LEN);
-        memcpy(crc_data + H_LEN, data_buffer, nbytes);
+	unsigned int abs = window_lookup((unsigned char) r->payload[2]);
+	if (abs == 0)
+		return;
 
-        trailer t;
-        t.check = crc16_ccitt(crc_data, crc_len);
-        t.mark = MARK;
+	slot *sl = &window[abs % WINDOW_SLOTS];
+	if (sl->acked || sl->path < 0)
+		return;
+	kpath *p = &paths[sl->path];
+	if (r->payload[3] == TYPE_Y) {
+		sl->acked = 1;
+		p->inflight--;
+		if (sl->order > p->acked_order)
+			p->acked_order = sl->order;
+		timer_cancel(&loop, &sl->timer);
+		keep_reply(&sl->m, r);
+		long long sample = 0;
+		if (sl->sent == 1) {
+			sample = now_us() - sl->sent_at;
+			rtt_sample(&p->rtt, sample);
+		}
+		cong_ack(&p->cong, p->rtt.srtt, sample);
+	} else if (r->payload[3] == TYPE_N) {
+		//a packet overtaken by those of another path is only missing,
+		//until one sent after it on its own path gets through
+		if (npaths > 1 && sl->order > p->acked_order)
+			return;
+		stats.naks++;
+		path_failed(p);
+		size_failed(&sizes, sl->size);
+		window_transmit(sl);
+	}
+}
 
-        unsigned char* buffer = malloc((H_LEN + nbytes + T_LEN) *
-				       sizeof(char));
-        memcpy(buffer, &h, H_LEN);
-        memcpy(buffer + H_LEN, data_buffer, nbytes);
-        memcpy(buffer + H_LEN + nbytes, &t, T_LEN);
+/*
+ * Function that handles the replies queued on the socket of a path, all at
+ * once
+ */
+void window_readable(void* arg)
+{
+	kpath *p = arg;
+	int n = recv_messages_on(p->id, reply_bufs, MAX_BATCH, 0);
 
-        return buffer;
+	for (int i = 0; i < n; ++i)
+		window_reply(reply_bufs[i]);
 }
 
 /*
- * Function that creates an EOF 'Z' package, or an EOT 'B' package
+ * Function that reads the notifications of the input reader, which only
+ * wake the loop up
  */
-unsigned char* create_eo(int seq, char type)
+void input_readable(void* arg)
 {
-        unsigned char *buffer = malloc(P_LEN * sizeof(unsigned char*));
+	unsigned long long count;
+	read(input_watch.fd, &count, sizeof(count));
+}
 
-        pkg e;
-        e.h.soh = SOH;
-        e.h.seq = seq;
-        e.h.len = P_LEN - 2;
-        e.h.type = type;
+/*
+ * Function that sends the queued burst and handles the next events of the
+ * loop: acknowledgements, expired retransmission timers or input that
+ * became available. Returns -1 if a packet timed out too many times.
+ */
+int window_wait()
+{
+	window_send_burst();
 
-        int crc_len = H_LEN;
-        char crc_data[crc_len];
-        memcpy(crc_data, &e, H_LEN);
+	for (int i = 0; i < npaths; ++i)
+		paths[i].backed_off = 0;
+	if (reactor_run(&loop) < 0)
+		return -1;
 
-        e.t.check = crc16_ccitt(crc_data, crc_len);
-        e.t.mark = MARK;
+	//time from the first transmission until the packet leaves the window
+	unsigned long long crt_ack = now_us();
+	while (base < next && window[base % WINDOW_SLOTS].acked) {
+		stats_record(&stats.queue_delay,
+			     crt_ack - window[base % WINDOW_SLOTS].first_at);
+		base++;
+	}
 
-        memcpy(buffer, &e, P_LEN);
-        return buffer;
+	return window_failed ? -1 : 0;
 }
 
 /*
- * Utility function that sends a message to the receiver and checks if timeout 
- * takes place
+ * Function that sends the parity packets of the current FEC block, if it
+ * has any packet, and starts the next block. A parity packet carries its
+ * index and the number of packets of the block, which it names by the
+ * sequence number of the first one.
  */
-msg* check_timeout(msg* s, int seq)
+void fec_send()
 {
-        int ctr = 3;
-        while (ctr > 0) {
-                send_message(s);
-                msg* r = receive_message_timeout(TIME * 1000);
-                if (r == NULL) {
-			printf("[timeout] seq = %d, try = %d\n", seq, 4 - ctr); 
-                        ctr--;
-		}
-                else
-                        return r;
+	if (fec.n == 0)
+		return;
+
+	unsigned long long start = now_us();
+	const msg* out[FEC_MAX_K];
+	int ext = packet_ext(2 + fec.len, codec_chkt);
 
-        }
-        return NULL;
+	//the block goes out before its parity
+	window_send_burst();
+	for (int j = 0; j < fec.k; ++j) {
+		unsigned char* data = packet_data(&fec_out[j], ext);
+		data[0] = j;
+		data[1] = fec.n;
+		memcpy(data + 2, fec.parity[j], fec.len);
+		seal_packet(&fec_out[j], fec.start % seq_mod, TYPE_P,
+			    2 + fec.len, ext);
+		out[j] = &fec_out[j];
+		stats_sent(fec_out[j].len);
+	}
+	send_messages_on(paths[path_pick(paths, npaths, 0)].id, out, fec.k);
+	stats.fec_parity += fec.k;
+
+	//the timers of the block restart from its parity
+	unsigned long long crt = now_us();
+	for (int i = 0; i < fec.n; ++i) {
+		slot *sl = &window[(fec.start + i) % WINDOW_SLOTS];
+		sl->fec_at = crt;
+		if (!sl->acked)
+			timer_arm(&loop, &sl->timer, window_deadline(sl));
+	}
+
+	fec_reset(&fec, next, fec_k, FEC_HEADER + maxl);
+	stats.fec_us += now_us() - start;
 }
 
 /*
- * Function that sends a message to the receiver
- * It is ensured that the sender receives first an acknoledgement from 
- * the receiver, and that no timeout takes place
- */ 
-msg* send(msg* s, int seq)
+ * Function that adds a packet sent for the first time to the parity of its
+ * block, sending the parity once the block is complete
+ */
+void fec_packet(msg* m)
 {
-        msg *r = check_timeout(s, seq);
-        if (r == NULL) 
-                return NULL;
+	unsigned long long start = now_us();
+	frame f;
 
-        while (r->payload[3] != TYPE_Y) {
-		r = check_timeout(s, seq);
-                if (r == NULL)         
+	parse_packet(m, &f);
+	fec_add(&fec, f.type, f.data, f.len);
+	stats.fec_us += now_us() - start;
+
+	if (fec.n == fec_n)
+		fec_send();
+}
+
+/*
+ * Function that returns the buffer in which the next packet is encoded: a
+ * free slot of the sliding window, waiting for room if the receiver's
+ * window is full or no path has room in its congestion window; stop-and-
+ * wait is a window of one. Returns NULL if a packet timed out too many
+ * times while waiting.
+ */
+msg* next_buffer()
+{
+	//a FEC block must fit in flight, since its parity is sent once it is
+	//complete and the receiver may wait for it
+	while (next - base >= (unsigned int) window_size ||
+	       (next - base >= (unsigned int) fec_n &&
+		path_pick(paths, npaths, 1) < 0))
+		if (window_wait() < 0)
 			return NULL;
-			
-        }
-        return r;
+
+	return &window[next % WINDOW_SLOTS].m;
 }
 
-/* 
- * Increment the sequence number modulo mod 
+/*
+ * Function that waits until every packet in the window is acknowledged
  */
-int increment_seq(int seq, int mod) 
-{	
-	return (seq + 1) % mod;
+int window_flush()
+{
+	while (base < next)
+		if (window_wait() < 0)
+			return -1;
+	return 0;
+}
+
+/*
+ * Function that delivers the packet encoded in next_buffer() reliably
+ * through the sliding window; a send that fails is retransmitted like a
+ * lost packet, and only window_wait() reports giving up
+ */
+void transmit(msg* s, int seq)
+{
+	stats_tick();
+
+	slot *sl = &window[next % WINDOW_SLOTS];
+	sl->abs = next;
+	sl->acked = 0;
+	sl->tries = 0;
+	sl->sent = 0;
+	sl->first_at = now_us();
+	sl->fec_at = 0;
+	sl->size = s->payload[3] == TYPE_D ? sizes.current : -1;
+	sl->path = -1;
+	next++;
+
+	window_transmit(sl);
+	if (fec_k)
+		fec_packet(&sl->m);
+}
+
+/*
+ * Function that emits the pending run of the encoder if it fits in room
+ * bytes. Long runs and the prefix character itself are sent as
+ * prefix, count, byte; short runs as literals, split if needed.
+ */
+int rept_emit(rept_encoder* e, unsigned char* out, int room)
+{
+	if (e->count >= REPT_MIN || (e->count > 0 && e->byte == rept)) {
+		if (room < 3)
+			return 0;
+		out[0] = rept;
+		out[1] = e->count;
+		out[2] = e->byte;
+		e->count = 0;
+		return 3;
+	}
+
+	int n = e->count < room ? e->count : room;
+	memset(out, e->byte, n);
+	e->count -= n;
+	return n;
+}
+
+/*
+ * Streaming repeat-count encoder: consumes input until it is exhausted or
+ * the output is full. Returns the number of bytes written and stores the
+ * number of bytes consumed in used.
+ */
+int rept_encode(rept_encoder* e, const unsigned char* in, int len, int* used,
+		unsigned char* out, int room)
+{
+	int written = 0;
+	int i;
+
+	for (i = 0; i < len; ++i) {
+		if (e->count > 0 && (in[i] != e->byte || e->count == REPT_MAX)) {
+			written += rept_emit(e, out + written, room - written);
+			if (e->count > 0)
+				break;
+		}
+		e->byte = in[i];
+		e->count++;
+	}
+
+	*used = i;
+	return written;
+}
+
+/*
+ * Function that slides the window from pos to the first place it matches a
+ * block of the receiver's copy, giving up after DELTA_SCAN bytes. Returns
+ * the block, or -1 with pos past the bytes scanned, which become literals;
+ * the bytes after the last whole window are literals as well.
+ */
+int delta_scan(delta_encoder* d)
+{
+	int block = basis.block;
+	long long end = d->pos + DELTA_SCAN;
+	//right after a block, the next one of the run is the likeliest
+	int hint = d->run_count > 0 && !d->run_closed ?
+		   d->run_block + d->run_count : -1;
+
+	while (d->pos + block <= d->size) {
+		if (!d->rolled) {
+			d->weak = delta_weak(d->map + d->pos, block);
+			d->rolled = 1;
+		}
+		int j = delta_index_find(&basis, d->weak, d->map + d->pos,
+					 d->pos == d->lit ? hint : -1);
+		if (j >= 0)
+			return j;
+		if (d->pos + block == d->size)
+			break;
+		if (d->pos == end)
+			return -1;
+
+		d->weak = delta_roll(d->weak, d->map[d->pos],
+				     d->map[d->pos + block], block);
+		d->pos++;
+	}
+
+	d->pos = d->size;
+	d->rolled = 0;
+	return -1;
+}
+
+/*
+ * Function that adds the block at pos to the current run
+ */
+void delta_take(source* src, int block)
+{
+	delta_encoder* d = &src->delta;
+
+	if (d->run_count == 0)
+		d->run_block = block;
+	d->run_count++;
+	d->pos += basis.block;
+	d->lit = d->pos;
+	d->rolled = 0;
+	stats.goodput_bytes += basis.block;
+	stats.delta_copied += basis.block;
+}
+
+/*
+ * Function that fills the data field of the next D packet with the delta of
+ * the mapped file against the receiver's copy: literals, repeat-compressed,
+ * and references to runs of its blocks, escaped as a repeat count of zero
+ */
+int fill_delta(source* src, unsigned char* out, int len)
+{
+	delta_encoder* d = &src->delta;
+	int written = 0;
+
+	while (written < len) {
+		//a run goes out before the literals or the block that end it
+		if (d->run_count > 0 && d->run_closed) {
+			written += rept_emit(&src->rept, out + written,
+					     len - written);
+			if (src->rept.count > 0 ||
+			    len - written < 2 + DELTA_COPY)
+				break;
+			out[written] = rept;
+			out[written + 1] = 0;
+			memcpy(out + written + 2, &d->run_block, 4);
+			out[written + 6] = d->run_count;
+			written += 2 + DELTA_COPY;
+			d->run_count = 0;
+			d->run_closed = 0;
+			continue;
+		}
+
+		if (d->lit < d->pos) {
+			int used;
+			written += rept_encode(&src->rept, d->map + d->lit,
+					       d->pos - d->lit, &used,
+					       out + written, len - written);
+			d->lit += used;
+			stats.goodput_bytes += used;
+			stats.delta_literal += used;
+			if (d->lit < d->pos)
+				break;
+			continue;
+		}
+
+		if (d->match >= 0) {
+			delta_take(src, d->match);
+			d->match = -1;
+			continue;
+		}
+
+		if (d->pos >= d->size) {
+			if (d->run_count > 0) {
+				d->run_closed = 1;
+				continue;
+			}
+			written += rept_emit(&src->rept, out + written,
+					     len - written);
+			if (src->rept.count == 0)
+				src->done = 1;
+			break;
+		}
+
+		int j = delta_scan(d);
+		if (j >= 0 && d->pos == d->lit && d->run_count > 0 &&
+		    j == d->run_block + d->run_count &&
+		    d->run_count < DELTA_RUN_MAX) {
+			delta_take(src, j);
+			continue;
+		}
+		if (d->run_count > 0)
+			d->run_closed = 1;
+		d->match = j;
+	}
+
+	return written;
+}
+
+/*
+ * Function that fills the data field of the next D packet from the source,
+ * compressing it first if a repeat prefix was negotiated, so that the
+ * packet carries up to len encoded bytes
+ */
+int fill_data(source* src, unsigned char* out, int len)
+{
+	int written = 0;
+
+	if (src->delta.map != NULL)
+		return fill_delta(src, out, len);
+
+	while (written < len && !src->done) {
+		//what is already there goes out rather than wait for more
+		if (written > 0 && !reader_ready(&src->in))
+			break;
+		int avail = reader_avail(&src->in);
+		unsigned char* in = src->in.buffer + src->in.pos;
+
+		if (avail == 0) {
+			int n = rept_emit(&src->rept, out + written,
+					  len - written);
+			written += n;
+			if (src->rept.count > 0)
+				break;
+			src->done = 1;
+			break;
+		}
+
+		if (rept) {
+			int used;
+			written += rept_encode(&src->rept, in, avail, &used,
+					       out + written, len - written);
+			src->in.pos += used;
+			stats.goodput_bytes += used;
+			if (used < avail)
+				break;
+		} else {
+			int n = avail < len - written ? avail : len - written;
+			memcpy(out + written, in, n);
+			src->in.pos += n;
+			stats.goodput_bytes += n;
+			written += n;
+		}
+	}
+
+	return written;
+}
+
+/*
+ * Function that encodes the 'A' packet of a file whose size is known, so the
+ * receiver can allocate it up front. Returns 0 if there is nothing to send.
+ */
+int encode_attributes(msg* m, int seq, int fd, long long offset, int block)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return 0;
+
+	unsigned char attrs[64];
+	int n = attr_put(attrs, ATTR_LENGTH, st.st_size);
+	if (offset > 0)
+		n += attr_put(attrs + n, ATTR_OFFSET, offset);
+	if (block > 0)
+		n += attr_put(attrs + n, ATTR_BLOCK, block);
+	encode_packet(m, seq, TYPE_A, attrs, n);
+	return 1;
+}
+
+/*
+ * Function that checks the copy the receiver reported in its acknowledgement
+ * of the 'F' packet against the start of the file. Returns the offset to
+ * resume from, 0 if the copy is not a prefix of the file.
+ */
+long long resume_offset(int fd)
+{
+	frame f;
+	unsigned int crc;
+
+	if (file_reply.len == 0)
+		return 0;
+	parse_packet(&file_reply, &f);
+
+	long long size = attr_get(&f, ATTR_LENGTH);
+	long long check = attr_get(&f, ATTR_CHECK);
+	if (size <= 0 || file_crc(fd, size, &crc) < 0 || crc != check)
+		return 0;
+	return size;
+}
+
+/*
+ * Size of the copy the receiver reported in its acknowledgement of the 'F'
+ * packet, 0 if it holds none
+ */
+long long held_length()
+{
+	frame f;
+
+	if (file_reply.len == 0)
+		return 0;
+	parse_packet(&file_reply, &f);
+	long long size = attr_get(&f, ATTR_LENGTH);
+	return size > 0 ? size : 0;
+}
+
+/*
+ * Function that asks the receiver for the signatures of the size bytes it
+ * holds of the file, one 'H' packet per reply's worth of blocks, and maps
+ * the file for the delta encoder. Returns the block size, 0 if the file is
+ * to be sent whole, -1 if a packet timed out too many times.
+ */
+int delta_request(source* src, int fd, long long size, int* seq)
+{
+	struct stat st;
+	if (size <= 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0)
+		return 0;
+
+	int block = delta_block_size(size);
+	int nblocks = size / block;
+	if (nblocks == 0 || delta_index_open(&basis, block, nblocks) < 0)
+		return 0;
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		delta_index_close(&basis);
+		return 0;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	//the signatures come back in the acknowledgements
+	int per = maxl / DELTA_SIG > 0 ? maxl / DELTA_SIG : 1;
+	for (int i = 0; i < nblocks; i += per) {
+		msg *s = next_buffer();
+		if (s == NULL)
+			return -1;
+
+		unsigned char attrs[64];
+		int n = attr_put(attrs, ATTR_BLOCK, block);
+		n += attr_put(attrs + n, ATTR_INDEX, i);
+		n += attr_put(attrs + n, ATTR_COUNT,
+			      nblocks - i < per ? nblocks - i : per);
+		encode_packet(s, *seq, TYPE_H, attrs, n);
+		transmit(s, *seq);
+		*seq = increment_seq(*seq, seq_mod);
+	}
+	if (fec_k)
+		fec_send();
+	if (window_flush() < 0)
+		return -1;
+	delta_index_build(&basis);
+
+	memset(&src->delta, 0, sizeof(src->delta));
+	src->delta.map = map;
+	src->delta.size = st.st_size;
+	src->delta.match = -1;
+	return block;
+}
+
+/*
+ * Function that encodes the 'Z' packet of a delta, carrying the size and
+ * CRC of the whole file for the receiver to check the copy it rebuilt
+ */
+void encode_delta_eof(msg* s, int seq, int fd, long long size)
+{
+	unsigned char attrs[64];
+	unsigned int crc;
+
+	if (file_crc(fd, size, &crc) < 0) {
+		encode_ctl(s, seq, TYPE_Z);
+		return;
+	}
+	int n = attr_put(attrs, ATTR_LENGTH, size);
+	n += attr_put(attrs + n, ATTR_CHECK, crc);
+	encode_packet(s, seq, TYPE_Z, attrs, n);
+}
+
+/*
+ * Function that asks the receiver, once the delta of the file is
+ * acknowledged, for the size and CRC of the copy it ended up with. Returns
+ * 1 if they are the file's, 0 if it must be sent whole, -1 if a packet
+ * timed out too many times.
+ */
+int delta_verify(int fd, long long size, int* seq)
+{
+	if (fec_k)
+		fec_send();
+	if (window_flush() < 0)
+		return -1;
+
+	msg *s = next_buffer();
+	if (s == NULL)
+		return -1;
+	file_reply.len = 0;
+	encode_packet(s, *seq, TYPE_H, "", 0);
+	transmit(s, *seq);
+	*seq = increment_seq(*seq, seq_mod);
+	if (fec_k)
+		fec_send();
+	if (window_flush() < 0)
+		return -1;
+	return resume_offset(fd) == size;
+}
+
+/*
+ * Function that waits, handling the events of the window meanwhile, until
+ * the input has data for the next packet. Returns -1 if a packet timed out
+ * too many times.
+ */
+int source_wait(source* src)
+{
+	while (src->delta.map == NULL && !reader_ready(&src->in))
+		if (window_wait() < 0)
+			return -1;
+	return 0;
+}
+
+/*
+ * Function that starts watching the reader of the input, whose thread wakes
+ * up the loop once it publishes data
+ */
+void source_watch(source* src)
+{
+	input_watch.fd = src->in.ready_fd;
+	input_watch.fn = input_readable;
+	input_watch.arg = NULL;
+	reactor_add(&loop, &input_watch);
+}
+
+/*
+ * Function that reports an aborted transmission. Returns the exit status
+ * of the sender.
+ */
+int abort_timeout()
+{
+	printf("=== Transmission experienced timeout ===\n\n");
+	printf("   ##### ABORTING TRANSMISSION. #####\n");
+	stats_dump("abort");
+	return 1;
 }
 
 int main(int argc, char** argv) 
 {
-    	init(HOST, PORT);
+	int windo = WINDO;
+	int opt;
+	//name announced in the F packet of the standard input stream
+	char *stream_name = STREAM_NAME;
+	int fecn = 0, feck = 0;
+	int resend = 0;
+	int deltas = 0;
+	int archiving = 0;
+	char chkt = CHKT_CRC32C;
+	//ports of the links the packets are striped over
+	int ports[MAX_PATHS];
+	int nports = 0;
+	//files that could not be opened, left out of the transfer
+	int skipped = 0;
+	//set while a file whose delta did not match is sent again whole
+	int whole = 0;
+
+	maxl = MAXLX;
+	rept = REPT_PREFIX;
+	while ((opt = getopt(argc, argv, "w:l:Rn:f:rdaCm:p:")) != -1) {
+		switch (opt) {
+			case 'p':
+				for (char *t = strtok(optarg, ","); t != NULL;
+				     t = strtok(NULL, ",")) {
+					if (nports == MAX_PATHS) {
+						printf("At most %d paths\n",
+						       MAX_PATHS);
+						return 1;
+					}
+					ports[nports++] = atoi(t);
+				}
+				break;
+			case 'm':
+				if (strcmp(optarg, "aimd") == 0) {
+					cong_mode = CONG_AIMD;
+				} else if (strcmp(optarg, "delay") == 0) {
+					cong_mode = CONG_DELAY;
+				} else if (strcmp(optarg, "off") == 0) {
+					cong_mode = CONG_OFF;
+				} else {
+					printf("Congestion control is aimd,"
+					       " delay or off\n");
+					return 1;
+				}
+				break;
+			case 'C':
+				chkt = CHKT_CRC16;
+				break;
+			case 'a':
+				archiving = 1;
+				break;
+			case 'd':
+				deltas = 1;
+				break;
+			case 'r':
+				resend = 1;
+				break;
+			case 'f':
+				if (sscanf(optarg, "%d,%d", &fecn, &feck) != 2 ||
+				    fecn < 1 || fecn > FEC_MAX_N ||
+				    feck < 1 || feck > FEC_MAX_K) {
+					printf("FEC takes N,K with N between 1"
+					       " and %d and K between 1 and %d\n",
+					       FEC_MAX_N, FEC_MAX_K);
+					return 1;
+				}
+				break;
+			case 'n':
+				stream_name = optarg;
+				break;
+			case 'R':
+				rept = REPT;
+				break;
+			case 'l':
+				maxl = atoi(optarg);
+				if (maxl < 1 || maxl > (int) MAXLX) {
+					printf("Packet length must be between 1"
+					       " and %d\n", (int) MAXLX);
+					return 1;
+				}
+				break;
+			case 'w':
+				windo = atoi(optarg);
+				if (windo < 1 || windo > MAX_WINDO) {
+					printf("Window must be between 1 and"
+					       " %d\n", MAX_WINDO);
+					return 1;
+				}
+				break;
+			default:
+				printf("Usage: %s [-w window] [-l length] [-R]"
+				       " [-n name] [-f N,K] [-r] [-d] [-a] [-C]"
+				       " [-m aimd|delay|off] [-p port,...]"
+				       " files..."
+				       " (- for stdin)\n",
+				       argv[0]);
+				return 1;
+		}
+	}
+
+	//a repeat sequence takes three bytes and must fit in one packet, as
+	//must a block reference
+	if (maxl < 3)
+		rept = REPT;
+	if (maxl < 2 + DELTA_COPY)
+		deltas = 0;
+
+	//an archive sends every file whole, in one stream
+	if (archiving)
+		resend = deltas = 0;
+
+	//a parity packet carries a whole symbol after its index and count
+	if (fecn > 0 && maxl > (int) (MAXLX - FEC_HEADER - 2))
+		maxl = MAXLX - FEC_HEADER - 2;
+
+	if (nports == 0)
+		ports[nports++] = PORT;
+	for (npaths = 0; npaths < nports; ++npaths)
+		path_init(&paths[npaths], add_path(HOST, ports[npaths]), TIME,
+			  cong_mode, window_size);
+	set_block_check(CHKT_CRC16);
+	stats_open("sender");
+	for (int i = 0; i < MAX_BATCH; ++i)
+		reply_bufs[i] = &replies[i];
+
+	if (reactor_open(&loop) < 0) {
+		printf("=== Unable to start the event loop ===\n");
+		return 1;
+	}
+	for (int i = 0; i < npaths; ++i) {
+		paths[i].watch.fd = path_fd(paths[i].id);
+		paths[i].watch.fn = window_readable;
+		paths[i].watch.arg = &paths[i];
+		reactor_add(&loop, &paths[i].watch);
+	}
+	for (int i = 0; i < WINDOW_SLOTS; ++i)
+		timer_init(&window[i].timer, window_expired, &window[i]);
 		
-	msg s;
 	int seq = 0; 
 	printf("\n      ##### BEGINNING TRANSMISSION. #####\n");	
 		
-	//send init package
-	unsigned char* buffer = create_s(seq);		
-	memcpy(&s.payload, buffer, S_LEN);
-	s.len = S_LEN;
-    	msg *r = send(&s, seq);
-	if (r == NULL) {
+	//send init package, in a window of one until the receiver answers
+	msg *s = next_buffer();
+	create_s(s, seq, windo, maxl, rept, fecn, feck, resend,
+		 deltas, archiving, chkt);
+	transmit(s, seq);
+	if (window_flush() < 0) {
 		printf("=== Unable to establish connection ===\n\n");           
                 printf("  ##### ABORTING TRANSMISSION. #####\n");   
-		return 0;
+		return 1;
+	}
+	negotiate(&init_reply);
+	if (window_size > 1)
+		printf("=== Sliding window of %d packets ===\n", window_size);
+	if (maxl > MAXL)
+		printf("=== Long packets of %d bytes ===\n", maxl);
+	if (rept)
+		printf("=== Repeat prefix '%c' ===\n", rept);
+	if (codec_chkt == CHKT_CRC32C)
+		printf("=== Block check CRC32C ===\n");
+	if (window_size > 1 && cong_mode == CONG_DELAY)
+		printf("=== Delay-based congestion control ===\n");
+	else if (window_size > 1 && cong_mode == CONG_AIMD)
+		printf("=== AIMD congestion control ===\n");
+	if (npaths > 1)
+		printf("=== Striped over %d paths ===\n", npaths);
+	if (archive)
+		printf("=== Archive of %d files ===\n", argc - optind);
+	if (fec_k) {
+		printf("=== FEC: %d parity per %d packets ===\n", fec_k, fec_n);
+		fec_reset(&fec, next, fec_k, FEC_HEADER + maxl);
 	}
-	seq = increment_seq(seq, MODULO_SEQ);
+	seq = increment_seq(seq, seq_mod);
+
+	//data packets are all extended once the longest does not fit a normal
+	//header
+	int ext = packet_ext(maxl, codec_chkt);
+	size_init(&sizes, maxl, (ext ? HX_LEN : H_LEN) + codec_tlen);
 	
-	for (int i = 1; i < argc; ++i) {
-		printf("\n      ##### SENDING FILE: %s #####\n", argv[i]); 
+	for (int i = optind; i < argc; ++i) {
+		//"-" streams the standard input under a logical name, and an
+		//archive carries all the files left, which the reader opens
+		int stream = !archive && strcmp(argv[i], "-") == 0;
+		char *name = archive ? ARCHIVE_NAME :
+			     stream ? stream_name : argv[i];
+		printf("\n      ##### SENDING FILE: %s #####\n", name); 
 		
 		//open file for reading
-		int fd = open(argv[i], O_RDONLY);	
-		if (fd < 0) {
-			 printf("=== File %s could not be"
-				" opened ===\n\n", argv[i]);
-                         printf(" ##### ABORTING TRASMISSION. #####\n");
-                         return 0;
+		source src;
+		memset(&src, 0, sizeof(src));
+		int fd = archive ? -1 :
+			 stream ? STDIN_FILENO : open(argv[i], O_RDONLY);
+		if (fd < 0 && !archive) {
+			//the others still go, the run fails at the end
+			printf("=== File %s could not be opened, skipped"
+			       " ===\n\n", argv[i]);
+			skipped++;
+			continue;
 		}
 		
 		//send file header
-		unsigned char* buffer = create_f(argv[i], seq); 	
-		memcpy(&s.payload, buffer, strlen((char *) buffer));
-		s.len = strlen((char *) buffer);
-		r = send(&s, seq);
-		if (r == NULL) {
-			printf("=== Transmission experienced timeout ===\n\n");
-			printf("   ##### ABORTING TRANSMISSION. #####\n");
-			return 0;	
-		}		
-		seq = increment_seq(seq, MODULO_SEQ);
-		
-		//send data
-		unsigned char* data_buffer = malloc(MAXL * 
-						    sizeof(unsigned char));
-		int nbytes = read(fd, data_buffer, MAXL);	
-		
-		while (nbytes == MAXL) {
-			int len = H_LEN + nbytes + T_LEN;
-			unsigned char* data = create_d(data_buffer, nbytes,
-						       seq);		
-			memcpy(&s.payload, data, len);
-			s.len = len;
-			r = send(&s, seq);
-			if (r == NULL) {
-				printf("=== Transmission experienced"
-				       " timeout ===\n\n");
-				printf("   ##### ABORTING TRANSMISSION." 
-				       " #####\n");
-				return 0;
+		if ((s = next_buffer()) == NULL)
+			return abort_timeout();
+		file_reply.len = 0;
+		encode_packet(s, seq, TYPE_F, name, strlen(name));
+		transmit(s, seq);
+		seq = increment_seq(seq, seq_mod);
+
+		//the acknowledgement of F tells what the receiver already holds
+		long long offset = 0;
+		if ((resume || delta) && !stream) {
+			if (fec_k)
+				fec_send();
+			if (window_flush() < 0)
+				return abort_timeout();
+			if (resume)
+				offset = resume_offset(fd);
+		}
+
+		//a copy that is not a prefix may still share blocks
+		int block = 0;
+		if (delta && !stream && offset == 0 && !whole &&
+		    (block = delta_request(&src, fd, held_length(), &seq)) < 0)
+			return abort_timeout();
+
+		//send the file size, if known, where the data starts and the
+		//blocks of a delta
+		if (attributes) {
+			if ((s = next_buffer()) == NULL)
+				return abort_timeout();
+			if (encode_attributes(s, seq, fd, offset, block)) {
+				transmit(s, seq);
+				seq = increment_seq(seq, seq_mod);
 			}
-			seq = increment_seq(seq, MODULO_SEQ);
+		}
 
-			nbytes = read(fd, data_buffer, MAXL);
+		if (offset > 0) {
+			printf("=== Resuming %s at byte %lld ===\n", name, offset);
+			lseek(fd, offset, SEEK_SET);
 		}
+		if (block > 0)
+			printf("=== Sending %s as a delta against %d blocks of"
+			       " %d bytes ===\n", name, basis.nblocks, block);
+		else if (archive)
+			reader_open_files(&src.in, argv + i, argc - i);
+		else
+			reader_open(&src.in, fd);
+		if (block == 0)
+			source_watch(&src);
 		
-		int len =  H_LEN + nbytes + T_LEN;
-		unsigned char* data = create_d(data_buffer, nbytes, seq);
-		memcpy(&s.payload, data, len);
-		s.len = len;
-		send(&s, seq); 
-		if (r == NULL) {
-			printf("=== Transmission experienced timeout ===\n\n");
-			printf("   ##### ABORTING TRANSMISSION. #####\n");
-			return 0;
-		}	
-		seq = increment_seq(seq, MODULO_SEQ);
-
-		//send eof
-		unsigned char* eof_buffer = create_eo(seq, TYPE_Z);
-		memcpy(&s.payload, eof_buffer, P_LEN);
-		s.len = P_LEN;
-		r = send(&s, seq);
-		if (r == NULL) {
-			printf("=== Transmission experienced timeout ===\n\n");
-			printf("   ##### ABORTING TRANSMISSION. #####\n"); 
-			return 0;
-		}
-		seq = increment_seq(seq, MODULO_SEQ);
+		//send data, the last packet being shorter (possibly empty)
+		do {
+			if ((s = next_buffer()) == NULL ||
+			    source_wait(&src) < 0)
+				return abort_timeout();
+			int nbytes = fill_data(&src, packet_data(s, ext),
+					       size_next(&sizes));
+			seal_packet(s, seq, TYPE_D, nbytes, ext);
+			transmit(s, seq);
+			seq = increment_seq(seq, seq_mod);
+		} while (!src.done);
+
+		//send eof; a delta's has the receiver check what it rebuilt
+		if ((s = next_buffer()) == NULL)
+			return abort_timeout();
+		if (block > 0)
+			encode_delta_eof(s, seq, fd, src.delta.size);
+		else
+			encode_ctl(s, seq, TYPE_Z);
+		transmit(s, seq);
+		seq = increment_seq(seq, seq_mod);
+		int matched = block > 0 ?
+			      delta_verify(fd, src.delta.size, &seq) : 1;
+		if (matched < 0)
+			return abort_timeout();
 			
-		close(fd);
+		if (block > 0) {
+			munmap((void *) src.delta.map, src.delta.size);
+			delta_index_close(&basis);
+		} else {
+			reactor_remove(&loop, &input_watch);
+			reader_close(&src.in);
+		}
+		if (!stream && !archive)
+			close(fd);
+		if (archive)
+			break;
+
+		//blocks matched by their hashes may still differ
+		whole = !matched;
+		if (whole) {
+			printf("=== Delta of %s did not match, sending it"
+			       " whole ===\n", name);
+			i--;
+		}
 	}
 
 	//send eot
-	unsigned char* eot_buffer = create_eo(seq, TYPE_B);
-	memcpy(&s.payload, eot_buffer, P_LEN);
-	s.len = P_LEN;
-	r = send(&s, seq);
+	if ((s = next_buffer()) == NULL)
+		return abort_timeout();
+	encode_ctl(s, seq, TYPE_B);
+	transmit(s, seq);
+	if (fec_k)
+		fec_send();
+	if (window_flush() < 0)
+		return abort_timeout();
+	for (int i = 0; npaths > 1 && i < npaths; ++i)
+		printf("[path %d] port %d, RTT %lld us, %u of %u failed\n",
+		       i, ports[i], paths[i].rtt.srtt, paths[i].failed,
+		       paths[i].sent);
+	stats_dump("eot");
+	reactor_close(&loop);
+
+	if (msg_outstanding() != 0)
+		printf("[leak] %d buffers outstanding\n", msg_outstanding());
+	if (skipped > 0) {
+		printf("  ##### %d FILES COULD NOT BE SENT. #####\n", skipped);
+		return 1;
+	}
     	return 0;
 }
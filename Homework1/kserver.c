@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include "kserver.h"
+#include "klib.h"
+#include "kcodec.h"
+#include "kreactor.h"
+
+static session sessions[SERVER_SESSIONS];
+static unsigned int last_id;
+
+static reactor server_loop;
+static kwatch listen_watch, child_watch;
+static ktimer greet_timer;
+
+//datagram being looked at, and the number of the session started for it,
+//set only in that session's process
+static msg* arrived;
+static unsigned int started;
+
+static session* session_find(const struct sockaddr_in* peer, unsigned int sid)
+{
+	for (int i = 0; i < SERVER_SESSIONS; ++i)
+		if (sessions[i].pid != 0 &&
+		    sessions[i].peer.sin_addr.s_addr == peer->sin_addr.s_addr &&
+		    sessions[i].peer.sin_port == peer->sin_port &&
+		    sessions[i].sid == sid)
+			return &sessions[i];
+	return NULL;
+}
+
+static session* session_free()
+{
+	for (int i = 0; i < SERVER_SESSIONS; ++i)
+		if (sessions[i].pid == 0)
+			return &sessions[i];
+	return NULL;
+}
+
+/*
+ * Function that starts a session for the SEND-INIT that came from peer:
+ * the new process leaves the daemon's loop, the daemon records it
+ */
+static void session_start(const struct sockaddr_in* peer, unsigned int sid)
+{
+	session *s = session_free();
+	if (s == NULL) {
+		printf("[server] no room for %s:%d\n",
+		       inet_ntoa(peer->sin_addr), ntohs(peer->sin_port));
+		return;
+	}
+
+	unsigned int id = ++last_id;
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return;
+	}
+	if (pid == 0) {
+		started = id;
+		return;
+	}
+
+	s->peer = *peer;
+	s->sid = sid;
+	s->id = id;
+	s->pid = pid;
+	printf("=== Session %u (%08x) from %s:%d ===\n", id, sid,
+	       inet_ntoa(peer->sin_addr), ntohs(peer->sin_port));
+	fflush(stdout);
+}
+
+/*
+ * Function that handles the datagrams queued on the daemon's socket
+ */
+static void listen_readable(void* arg)
+{
+	struct sockaddr_in peer;
+	frame f;
+	s_data d;
+
+	while (started == 0 && recv_message_from(arrived, &peer) >= 0) {
+		if (arrived->len < 4 || arrived->payload[3] != TYPE_S ||
+		    check_packet(arrived) < 0)
+			continue;
+		parse_packet(arrived, &f);
+		parse_s(&f, &d);
+		//while a session lives its socket takes what its peer sends,
+		//so the daemon only sees its SEND-INIT queued before that
+		if (session_find(&peer, s_session(&d)) != NULL)
+			continue;
+		session_start(&peer, s_session(&d));
+		if (started != 0 && accept_path(&peer) < 0) {
+			perror("accept_path");
+			_exit(1);
+		}
+	}
+}
+
+/*
+ * Function that removes the sessions that exited from the table
+ */
+static void child_readable(void* arg)
+{
+	//a session leaving the loop does not reap its siblings
+	if (started != 0)
+		return;
+
+	struct signalfd_siginfo info;
+	read(child_watch.fd, &info, sizeof(info));
+
+	pid_t pid;
+	int status;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+		for (int i = 0; i < SERVER_SESSIONS; ++i)
+			if (sessions[i].pid == pid) {
+				printf("=== Session %u ended (%d) ===\n",
+				       sessions[i].id,
+				       WIFEXITED(status) ?
+				       WEXITSTATUS(status) : -1);
+				fflush(stdout);
+				sessions[i].pid = 0;
+			}
+
+	//the link the session used forwards to the daemon again
+	greet_links();
+}
+
+/*
+ * Function that greets the links again, in case one restarted
+ */
+static void greet_expired(void* arg)
+{
+	greet_links();
+	timer_arm(&server_loop, &greet_timer, now_us() + SERVER_GREET * 1000ULL);
+}
+
+/*
+ * Function that runs the daemon over the n links on ports. Returns in the
+ * process of each session, with path 0 connected to its peer and its
+ * SEND-INIT in first, the number of the session; the daemon only returns
+ * -1, if it cannot start.
+ */
+int serve(char* remote, const int* ports, int n, msg* first)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	listen_path(remote, ports, n);
+	arrived = first;
+	if (reactor_open(&server_loop) < 0 ||
+	    (child_watch.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+		return -1;
+	listen_watch.fd = path_fd(0);
+	listen_watch.fn = listen_readable;
+	listen_watch.arg = NULL;
+	reactor_add(&server_loop, &listen_watch);
+	child_watch.fn = child_readable;
+	child_watch.arg = NULL;
+	reactor_add(&server_loop, &child_watch);
+	timer_init(&greet_timer, greet_expired, NULL);
+	timer_arm(&server_loop, &greet_timer, now_us() + SERVER_GREET * 1000ULL);
+	printf("=== Serving %d links ===\n", n);
+	fflush(stdout);
+
+	while (started == 0)
+		if (reactor_run(&server_loop) < 0)
+			return -1;
+
+	//the session keeps none of the daemon's descriptors
+	close(child_watch.fd);
+	reactor_close(&server_loop);
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	return started;
+}
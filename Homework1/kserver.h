@@ -0,0 +1,38 @@
+#ifndef KSERVER
+#define KSERVER
+
+#include <sys/types.h>
+#include "lib.h"
+
+/*
+ * Receiver daemon serving many senders at once. It waits on one socket,
+ * greeting every link it serves every SERVER_GREET millis, so a link that
+ * restarts learns where to forward again, and starts a session for each
+ * SEND-INIT of a session id it has not seen from that peer: the session,
+ * numbered in the order it started, is a process of its own whose socket
+ * shares the port and is connected to the peer, so its sequence space,
+ * files and buffers are its own and the kernel spreads sessions over the
+ * cores. Behind a link every sender has the link's address, so the table
+ * keeps each session by peer and session id, with its number and pid,
+ * until it exits. The socket of a session gets all its peer sends, so the
+ * SEND-INIT of a sender that starts over behind the same link reaches that
+ * session, which ends and lets it through to the daemon when sent again;
+ * whatever else reaches the daemon's socket belongs to a session not yet
+ * connected, or to one that ended, and is dropped.
+ */
+
+#define SERVER_SESSIONS 64
+#define SERVER_GREET 1000
+
+typedef struct {
+	struct sockaddr_in peer;
+	//session id the sender picked
+	unsigned int sid;
+	unsigned int id;
+	//0 for a free entry
+	pid_t pid;
+} session;
+
+int serve(char* remote, const int* ports, int n, msg* first);
+
+#endif
@@ -0,0 +1,139 @@
+#include <math.h>
+#include "ksize.h"
+#include "kstats.h"
+
+/*
+ * Function that starts with the longest packets, those negotiated
+ */
+void size_init(size_control* c, int maxl, int overhead)
+{
+	c->nbuckets = 0;
+	for (int len = maxl; c->nbuckets < SIZE_BUCKETS &&
+	     (c->nbuckets == 0 || len >= SIZE_MIN); len /= 2) {
+		c->len[c->nbuckets] = len;
+		c->sent[c->nbuckets] = c->failed[c->nbuckets] = 0;
+		c->measured[c->nbuckets] = 0;
+		c->memory[c->nbuckets] = SIZE_MEMORY;
+		c->nbuckets++;
+	}
+	c->current = 0;
+	c->overhead = overhead;
+	c->since = 0;
+	c->round = 0;
+	c->held = 0;
+	c->start_bytes = stats.goodput_bytes;
+	c->start_us = now_us();
+}
+
+/*
+ * Share of the link that goes to data with packets of length i, if bytes
+ * fail as often as they did with the current length
+ */
+static double size_model(const size_control* c, int i)
+{
+	int j = c->current;
+	double p = c->sent[j] ? (double) c->failed[j] / c->sent[j] : 0;
+	if (p > 0.99)
+		p = 0.99;
+
+	double ok = log(1 - p) / (c->len[j] + c->overhead);
+	return c->len[i] * exp(ok * (c->len[i] + c->overhead)) /
+	       (c->len[i] + c->overhead);
+}
+
+/*
+ * Expected goodput of length i
+ */
+static double size_estimate(const size_control* c, int i)
+{
+	if (c->measured[i] > 0 && c->round - c->measured[i] <= c->memory[i])
+		return c->rate[i];
+	//errors of single bytes always make longer packets look worse, so
+	//they are tried again once their goodput is forgotten
+	if (i < c->current)
+		return INFINITY;
+	return c->rate[c->current] * size_model(c, i) /
+	       size_model(c, c->current);
+}
+
+/*
+ * Function that measures the goodput of the interval that ended and moves
+ * to the next or previous length if it is expected to do clearly better
+ */
+static void size_choose(size_control* c)
+{
+	unsigned long long crt = now_us();
+	int j = c->current;
+
+	//the first interval also holds the start of the transfer
+	if (++c->round > 1 && crt > c->start_us) {
+		double rate = (stats.goodput_bytes - c->start_bytes) *
+			      1000000.0 / (crt - c->start_us);
+		//a length kept for a while is smoothed over its intervals
+		c->rate[j] = c->measured[j] == c->round - 1 ?
+			     (c->rate[j] + rate) / 2 : rate;
+		c->measured[j] = c->round;
+	}
+	//old transmissions weigh less than recent ones
+	if (c->sent[j] > 8 * SIZE_INTERVAL) {
+		c->sent[j] /= 2;
+		c->failed[j] /= 2;
+	}
+
+	int best = j;
+	double most = c->rate[j] * 1.05;
+	for (int i = j - 1; i <= j + 1; i += 2) {
+		if (i < 0 || i >= c->nbuckets)
+			continue;
+		double g = size_estimate(c, i);
+		if (g > most) {
+			best = i;
+			most = g;
+		}
+	}
+
+	if (best != j) {
+		//a length left right after it was tried is tried less often
+		if (c->held == 0 && c->memory[j] < SIZE_MEMORY_MAX)
+			c->memory[j] *= 2;
+		c->current = best;
+		c->sent[best] = c->failed[best] = 0;
+		c->held = 0;
+		stats.size_changes++;
+	} else if (++c->held == 1) {
+		c->memory[j] = SIZE_MEMORY;
+	}
+	c->start_bytes = stats.goodput_bytes;
+	c->start_us = crt;
+}
+
+/*
+ * Function that returns the data length of the next D packet
+ */
+int size_next(size_control* c)
+{
+	if (++c->since >= SIZE_INTERVAL) {
+		c->since = 0;
+		size_choose(c);
+	}
+
+	int len = c->len[c->current];
+	stats.packet_len = len;
+	stats_record(&stats.packet_len_bytes, len);
+	return len;
+}
+
+void size_sent(size_control* c, int bucket)
+{
+	if (bucket >= 0)
+		c->sent[bucket]++;
+}
+
+/*
+ * Function that counts a NAK or a timeout of a transmission
+ */
+void size_failed(size_control* c, int bucket)
+{
+	if (bucket >= 0)
+		c->failed[bucket]++;
+}
@@ -0,0 +1,51 @@
+#ifndef KSIZE
+#define KSIZE
+
+/*
+ * Length of the D packets, picked during a transfer among the negotiated
+ * maximum and its halves down to SIZE_MIN. Every SIZE_INTERVAL packets
+ * the goodput reached with the current length is measured, and the
+ * lengths next to it are judged either by their own goodput, if it was
+ * measured in the last SIZE_MEMORY intervals, or by scaling the current
+ * one as errors of single bytes would: with p the ratio of transmissions
+ * of the current length that were NAKed or timed out, a packet of len
+ * bytes carries len * (1 - p') / (len + overhead) of what it costs, p'
+ * being p over len instead of the current length; a longer length that
+ * was forgotten is simply tried again. The sender moves to a length
+ * expected to do clearly better, and keeps it only if it does.
+ */
+
+#define SIZE_BUCKETS 6
+#define SIZE_MIN 64
+//D packets between two choices
+#define SIZE_INTERVAL 128
+//choices after which a measured goodput is forgotten, doubled up to
+//SIZE_MEMORY_MAX each time a length is tried and left at once
+#define SIZE_MEMORY 8
+#define SIZE_MEMORY_MAX 128
+
+typedef struct {
+	int len[SIZE_BUCKETS];
+	//transmissions of each length and how many failed
+	unsigned int sent[SIZE_BUCKETS], failed[SIZE_BUCKETS];
+	//goodput of each length, in bytes per second, and the choice it was
+	//measured at, 0 if it was not
+	double rate[SIZE_BUCKETS];
+	int measured[SIZE_BUCKETS], memory[SIZE_BUCKETS];
+	int nbuckets;
+	//index of the length in use
+	int current;
+	//bytes of a packet besides its data
+	int overhead;
+	//packets and choices so far, choices the current length was kept for
+	//and where the interval started
+	int since, round, held;
+	unsigned long long start_bytes, start_us;
+} size_control;
+
+void size_init(size_control* c, int maxl, int overhead);
+int size_next(size_control* c);
+void size_sent(size_control* c, int bucket);
+void size_failed(size_control* c, int bucket);
+
+#endif
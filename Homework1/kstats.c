@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "kstats.h"
+
+kstats stats = { .fd = -1 };
+
+/*
+ * Function that starts the statistics of a transfer and opens the file they
+ * are dumped to, if one was asked for
+ */
+void stats_open(const char* role)
+{
+	stats.role = role;
+	stats.start = now_us();
+
+	const char* interval = getenv(STATS_INTERVAL_ENV);
+	stats.interval = (interval != NULL && atoi(interval) > 0 ?
+			  atoi(interval) : STATS_INTERVAL) * 1000ULL;
+	stats.next_dump = stats.start + stats.interval;
+
+	const char* path = getenv(STATS_ENV);
+	if (path != NULL && *path != '\0')
+		stats.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+}
+
+/*
+ * Function that bounds the length snprintf() reports to what was written
+ * into size bytes, so the next write starts at the terminator
+ */
+static int fit(int n, int size)
+{
+	return n < size ? n : size - 1;
+}
+
+/*
+ * Function that appends a histogram as a JSON object to buf
+ */
+static int format_histogram(char* buf, int size, const char* name,
+			    const histogram* h)
+{
+	int last = STATS_BUCKETS - 1;
+	while (last > 0 && h->count[last] == 0)
+		last--;
+
+	int n = fit(snprintf(buf, size, ", \"%s\": {\"count\": %llu,"
+			     " \"min\": %llu, \"mean\": %llu, \"max\": %llu,"
+			     " \"log2_buckets\": [", name, h->n, h->min,
+			     h->n ? h->sum / h->n : 0, h->max), size);
+	for (int i = 0; i <= last; ++i)
+		n += fit(snprintf(buf + n, size - n, i ? ", %llu" : "%llu",
+				  h->count[i]), size - n);
+	n += fit(snprintf(buf + n, size - n, "]}"), size - n);
+	return n;
+}
+
+/*
+ * Function that writes the statistics gathered so far as one JSON line;
+ * event tells a progress report from the final one
+ */
+void stats_dump(const char* event)
+{
+	if (stats.fd < 0)
+		return;
+
+	unsigned long long crt = now_us();
+	unsigned long long elapsed = crt - stats.start;
+	stats.next_dump = crt + stats.interval;
+
+	unsigned long long goodput = __atomic_load_n(&stats.goodput_bytes,
+						     __ATOMIC_RELAXED);
+	unsigned long long copied = __atomic_load_n(&stats.delta_copied,
+						    __ATOMIC_RELAXED);
+	char buf[4096];
+	int size = sizeof(buf);
+	int n = snprintf(buf, size,
+			 "{\"role\": \"%s\", \"event\": \"%s\","
+			 " \"elapsed_us\": %llu,"
+			 " \"packets_sent\": %llu, \"packets_received\": %llu,"
+			 " \"bytes_sent\": %llu, \"bytes_received\": %llu,"
+			 " \"retransmits\": %llu, \"timeouts\": %llu,"
+			 " \"naks\": %llu, \"crc_failures\": %llu,"
+			 " \"duplicates\": %llu, \"goodput_bytes\": %llu,"
+			 " \"goodput_bps\": %llu,"
+			 " \"fec_parity\": %llu, \"fec_repairs\": %llu,"
+			 " \"fec_failures\": %llu, \"fec_us\": %llu,"
+			 " \"delta_literal\": %llu, \"delta_copied\": %llu,"
+			 " \"cwnd\": %llu, \"ssthresh\": %llu, \"cwnd_cuts\": %llu,"
+			 " \"packet_len\": %llu, \"size_changes\": %llu",
+			 stats.role, event, elapsed,
+			 stats.packets_sent, stats.packets_received,
+			 stats.bytes_sent, stats.bytes_received,
+			 stats.retransmits, stats.timeouts,
+			 stats.naks, stats.crc_failures,
+			 stats.duplicates, goodput,
+			 elapsed ? goodput * 1000000 / elapsed : 0,
+			 stats.fec_parity, stats.fec_repairs,
+			 stats.fec_failures, stats.fec_us,
+			 stats.delta_literal, copied,
+			 stats.cwnd, stats.ssthresh, stats.cwnd_cuts,
+			 stats.packet_len, stats.size_changes);
+	n = fit(n, size);
+	n += format_histogram(buf + n, size - n, "rtt_us", &stats.rtt);
+	n += format_histogram(buf + n, size - n, "queue_delay_us",
+			      &stats.queue_delay);
+	n += format_histogram(buf + n, size - n, "cwnd_packets",
+			      &stats.cwnd_packets);
+	n += format_histogram(buf + n, size - n, "packet_len_bytes",
+			      &stats.packet_len_bytes);
+	n += fit(snprintf(buf + n, size - n, "}\n"), size - n);
+
+	write(stats.fd, buf, n);
+}
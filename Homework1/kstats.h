@@ -0,0 +1,111 @@
+#ifndef KSTATS
+#define KSTATS
+
+#include "klib.h"
+
+/*
+ * Transfer statistics of ksender and kreceiver. Counters are plain fields
+ * updated in place and distributions are log2 histograms, so recording is an
+ * increment; all formatting happens in stats_dump(), which writes one JSON
+ * line to the file named by the KERMIT_STATS environment variable at EOT and
+ * every KERMIT_STATS_INTERVAL milliseconds (default 1000) before that.
+ */
+
+//bucket i counts values in [2^i, 2^(i+1)), bucket 0 also 0; times are in
+//microseconds
+#define STATS_BUCKETS 32
+
+#define STATS_ENV "KERMIT_STATS"
+#define STATS_INTERVAL_ENV "KERMIT_STATS_INTERVAL"
+#define STATS_INTERVAL 1000
+
+typedef struct {
+	unsigned long long count[STATS_BUCKETS];
+	unsigned long long n, sum, min, max;
+} histogram;
+
+typedef struct {
+	//datagrams and the bytes they carried
+	unsigned long long packets_sent, packets_received;
+	unsigned long long bytes_sent, bytes_received;
+	unsigned long long retransmits, timeouts, naks, crc_failures;
+	unsigned long long duplicates;
+	//file bytes read by the sender or written by the receiver; the
+	//receiver's are counted with stats_add()
+	unsigned long long goodput_bytes;
+	//parity packets sent or received, packets rebuilt from them, blocks
+	//that lost too much, and the time spent coding
+	unsigned long long fec_parity, fec_repairs, fec_failures, fec_us;
+	//file bytes sent as literals or as references to blocks of the old
+	//copy, in delta mode; the receiver only tells the copies apart
+	unsigned long long delta_literal, delta_copied;
+	//congestion window and slow start threshold of the sender, in packets,
+	//and how many times a timeout cut the window
+	unsigned long long cwnd, ssthresh, cwnd_cuts;
+	//data length of the D packets of the sender and how many times it
+	//changed
+	unsigned long long packet_len, size_changes;
+	//round trip samples and the time packets wait in the window
+	histogram rtt, queue_delay;
+	//congestion window after each change
+	histogram cwnd_packets;
+	//data length picked for each D packet
+	histogram packet_len_bytes;
+
+	const char* role;
+	int fd;
+	unsigned long long start, next_dump, interval;
+} kstats;
+
+extern kstats stats;
+
+/*
+ * Function that records a value in a histogram
+ */
+static inline void stats_record(histogram* h, unsigned long long v)
+{
+	int b = v ? 63 - __builtin_clzll(v) : 0;
+	h->count[b < STATS_BUCKETS ? b : STATS_BUCKETS - 1]++;
+	if (h->n == 0 || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->n++;
+	h->sum += v;
+}
+
+static inline void stats_sent(int len)
+{
+	stats.packets_sent++;
+	stats.bytes_sent += len;
+}
+
+static inline void stats_received(int len)
+{
+	stats.packets_received++;
+	stats.bytes_received += len;
+}
+
+/*
+ * Function that adds to a counter kept by another thread than the one
+ * dumping the statistics, the disk stage of the receiver
+ */
+static inline void stats_add(unsigned long long* counter,
+			     unsigned long long v)
+{
+	__atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+void stats_open(const char* role);
+void stats_dump(const char* event);
+
+/*
+ * Function that writes a progress line if the dump interval has elapsed
+ */
+static inline void stats_tick()
+{
+	if (stats.fd >= 0 && now_us() >= stats.next_dump)
+		stats_dump("progress");
+}
+
+#endif
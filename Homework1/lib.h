@@ -1,18 +1,53 @@
 #ifndef LIB
 #define LIB
 
+#include <netinet/in.h>
+
 typedef struct {
     int len;
     char payload[1400];
 } msg;
 
+//most messages moved by one send_messages or recv_messages call
+#define MAX_BATCH 64
+//links one endpoint talks through at most
+#define MAX_PATHS 8
+
 void init(char* remote, int remote_port);
+//opens one more path to a link, returning its index; init() opens path 0
+int add_path(char* remote, int remote_port);
+//path 0 of a server, whose sessions each move to a socket of their own
+void listen_path(char* remote, const int* ports, int n);
+void greet_links();
+int recv_message_from(msg* r, struct sockaddr_in* from);
+int accept_path(const struct sockaddr_in* peer);
 void set_local_port(int port);
 void set_remote(char* ip, int port);
 int send_message(const msg* m);
 int recv_message(msg* r);
 msg* receive_message_timeout(int timeout); //timeout in milliseconds
+//pooled buffers; whatever receive_message_timeout returns goes back here
+msg* msg_acquire(void);
+void msg_release(msg* m);
+//buffers acquired and not yet released, to catch leaks
+int msg_outstanding(void);
+int send_messages(const msg* const* m, int n);
+//waits up to timeout ms for the first message, then drains at most n
+int recv_messages(msg* const* r, int n, int timeout);
+//the same on a given path; the calls above use path 0
+int send_messages_on(int path, const msg* const* m, int n);
+int recv_messages_on(int path, msg* const* r, int n, int timeout);
+//the UDP socket, for callers that wait on it with epoll
+int socket_fd(void);
+int path_fd(int path);
 unsigned short crc16_ccitt(const void *buf, int len);
+//continues a CRC over buf, so a frame can be checksummed piece by piece
+unsigned short crc16_update(unsigned short crc, const void *buf, int len);
+//CRC32C (Castagnoli), computed with the SSE4.2 crc32 instruction if present
+unsigned int crc32c(const void *buf, int len);
+unsigned int crc32c_update(unsigned int crc, const void *buf, int len);
+//switches both CRCs to the table kernels and back, for tests
+int crc_tables_only(int on);
 
 #endif
 
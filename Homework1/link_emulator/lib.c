@@ -1,5 +1,7 @@
+#define _GNU_SOURCE
 #include "lib.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <poll.h>
 #include <netinet/in.h>
 #include <stdio.h>
@@ -10,8 +12,42 @@
 #include <string.h>
 
 struct sockaddr_in addr_local, addr_remote;
-int s;
-struct pollfd fds[1];
+
+/*
+ * Paths: one socket per link the endpoint talks through, each bound to a
+ * port of its own and sending to its remote. Path 0 is the one init()
+ * opens, which the calls without a path use.
+ */
+typedef struct {
+    int fd;
+    struct sockaddr_in remote;
+} net_path;
+
+static net_path paths[MAX_PATHS];
+static int npaths;
+
+//links a server greets, again whenever it asks
+static struct sockaddr_in links[MAX_PATHS];
+static int nlinks;
+
+/*
+ * Message pool: POOL_SIZE buffers, each padded to a whole number of cache
+ * lines, handed out from a stack of free indices. When the pool runs dry
+ * buffers come from malloc, so callers never fail; msg_release tells them
+ * apart by address.
+ */
+#define CACHE_LINE 64
+#define POOL_SIZE 512
+
+typedef union {
+    msg m;
+    char pad[(sizeof (msg) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE];
+} __attribute__((aligned(CACHE_LINE))) pool_slot;
+
+static pool_slot pool[POOL_SIZE];
+static int pool_free[POOL_SIZE];
+static int pool_top = -1;
+static int outstanding;
 
 static const unsigned short crc16tab[256]= {
 	0x0000,0x1021,0x2042,0x3063,0x4084,0x50a5,0x60c6,0x70e7,
@@ -66,58 +102,524 @@ void set_remote(char* ip, int port) {
 }
 
 void init(char* remote, int REMOTE_PORT) {
+    add_path(remote, REMOTE_PORT);
+}
+
+int add_path(char* remote, int remote_port) {
+    if (npaths == MAX_PATHS) {
+        fprintf(stderr, "Too many paths\n");
+        exit(1);
+    }
+
+    int s;
     if ((s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
         perror("Error creating socket");
         exit(1);
     }
 
     set_local_port(0);
-    set_remote(remote, REMOTE_PORT);
+    set_remote(remote, remote_port);
 
     if (bind(s, (struct sockaddr*) &addr_local, sizeof (addr_local)) == -1) {
         perror("Failed to bind");
         exit(1);
     }
 
-    fds[0].fd = s;
-    fds[0].events = POLLIN;
+    paths[npaths].fd = s;
+    paths[npaths].remote = addr_remote;
 
+    //an empty datagram lets the link learn our address
     msg m;
-    send_message(&m);
+    const msg* empty = &m;
+    m.len = 0;
+    send_messages_on(npaths, &empty, 1);
+    return npaths++;
+}
+
+/*
+ * Opens path 0 of a server, on a port the sockets of its sessions share,
+ * and greets each of the n links on ports so that they forward to it
+ */
+void listen_path(char* remote, const int* ports, int n) {
+    int s, on = 1;
+    if ((s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+        perror("Error creating socket");
+        exit(1);
+    }
+    setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on));
+
+    set_local_port(0);
+    if (bind(s, (struct sockaddr*) &addr_local, sizeof (addr_local)) == -1) {
+        perror("Failed to bind");
+        exit(1);
+    }
+
+    paths[0].fd = s;
+    npaths = 1;
+    for (nlinks = 0; nlinks < n && nlinks < MAX_PATHS; ++nlinks) {
+        set_remote(remote, ports[nlinks]);
+        links[nlinks] = addr_remote;
+    }
+    greet_links();
+}
+
+/*
+ * Greets again the links of listen_path(), so that one restarted since
+ * learns where to forward
+ */
+void greet_links() {
+    msg m;
+    const msg* empty = &m;
+    m.len = 0;
+
+    for (int i = 0; i < nlinks; ++i) {
+        paths[0].remote = links[i];
+        send_messages_on(0, &empty, 1);
+    }
+}
+
+/*
+ * Receives a datagram queued on path 0 without waiting, storing where it
+ * came from. Returns its length, -1 if there is none.
+ */
+int recv_message_from(msg* r, struct sockaddr_in* from) {
+    socklen_t len = sizeof (*from);
+    r->len = recvfrom(paths[0].fd, r->payload, sizeof (r->payload),
+                      MSG_DONTWAIT, (struct sockaddr*) from, &len);
+    return r->len;
+}
+
+/*
+ * Moves path 0 to a socket of its own on the same port, connected to peer:
+ * the kernel hands what peer sends to that socket from then on, and what
+ * others send to the sockets left on the port. Returns -1 on failure.
+ */
+int accept_path(const struct sockaddr_in* peer) {
+    struct sockaddr_in local;
+    socklen_t len = sizeof (local);
+    int s, on = 1;
+
+    if (getsockname(paths[0].fd, (struct sockaddr*) &local, &len) == -1 ||
+        (s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+        return -1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on));
+    if (bind(s, (struct sockaddr*) &local, sizeof (local)) == -1 ||
+        connect(s, (const struct sockaddr*) peer, sizeof (*peer)) == -1) {
+        close(s);
+        return -1;
+    }
+
+    close(paths[0].fd);
+    paths[0].fd = s;
+    paths[0].remote = *peer;
+    return 0;
+}
+
+int send_messages(const msg* const* m, int n) {
+    return send_messages_on(0, m, n);
+}
+
+/*
+ * Sends the n messages of m with as few sendmmsg calls as possible.
+ * Only the m[i]->len payload bytes of each go on the wire; the receiver
+ * recovers the length from the size of the datagram.
+ * Returns the number of messages sent, or -1 if none could be.
+ */
+int send_messages_on(int path, const msg* const* m, int n) {
+    struct mmsghdr hdr[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+    int sent = 0;
+
+    while (sent < n) {
+        int count = n - sent < MAX_BATCH ? n - sent : MAX_BATCH;
+        for (int i = 0; i < count; ++i) {
+            iov[i].iov_base = (void*) m[sent + i]->payload;
+            iov[i].iov_len = m[sent + i]->len;
+            memset(&hdr[i].msg_hdr, 0, sizeof (hdr[i].msg_hdr));
+            hdr[i].msg_hdr.msg_name = &paths[path].remote;
+            hdr[i].msg_hdr.msg_namelen = sizeof (paths[path].remote);
+            hdr[i].msg_hdr.msg_iov = &iov[i];
+            hdr[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int ret = sendmmsg(paths[path].fd, hdr, count, 0);
+        if (ret <= 0)
+            return sent > 0 ? sent : -1;
+        sent += ret;
+    }
+    return sent;
+}
+
+int recv_messages(msg* const* r, int n, int timeout) {
+    return recv_messages_on(0, r, n, timeout);
+}
+
+/*
+ * Waits up to timeout millis (forever if negative) for a datagram, then
+ * drains at most n of the ones queued on the socket of a path into the
+ * buffers of r with a single recvmmsg, setting the len of each.
+ * Returns the number of messages received, 0 on timeout, -1 on error.
+ */
+int recv_messages_on(int path, msg* const* r, int n, int timeout) {
+    struct mmsghdr hdr[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+
+    if (n > MAX_BATCH)
+        n = MAX_BATCH;
+
+    if (timeout != 0) {
+        struct pollfd fds = { .fd = paths[path].fd, .events = POLLIN };
+        int ret = poll(&fds, 1, timeout);
+        if (ret <= 0 || !(fds.revents & POLLIN))
+            return ret < 0 ? -1 : 0;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        iov[i].iov_base = r[i]->payload;
+        iov[i].iov_len = sizeof (r[i]->payload);
+        memset(&hdr[i].msg_hdr, 0, sizeof (hdr[i].msg_hdr));
+        hdr[i].msg_hdr.msg_iov = &iov[i];
+        hdr[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int got = recvmmsg(paths[path].fd, hdr, n, MSG_DONTWAIT, NULL);
+    if (got < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+    for (int i = 0; i < got; ++i)
+        r[i]->len = hdr[i].msg_len;
+    return got;
+}
+
+int socket_fd(void) {
+    return paths[0].fd;
+}
+
+int path_fd(int path) {
+    return paths[path].fd;
 }
 
 int send_message(const msg* m) {
-    return sendto(s, m, sizeof (msg), 0, (struct sockaddr*) &addr_remote, sizeof (addr_remote));
+    return send_messages(&m, 1) == 1 ? m->len : -1;
+}
+
+int recv_message(msg* ret) {
+    if (recv_messages(&ret, 1, -1) != 1)
+        ret->len = -1;
+    return ret->len;
 }
 
-msg* receive_message() {
-    msg* ret = (msg*) malloc(sizeof (msg));
-    if (recvfrom(s, ret, sizeof (msg), 0, NULL, NULL) == -1) {
-        free(ret);
+msg* msg_acquire(void) {
+    if (pool_top == -1) {
+        //first use: every slot is free
+        for (int i = 0; i < POOL_SIZE; ++i)
+            pool_free[i] = POOL_SIZE - 1 - i;
+        pool_top = POOL_SIZE;
+    }
+
+    outstanding++;
+    if (pool_top > 0)
+        return &pool[pool_free[--pool_top]].m;
+    return (msg*) malloc(sizeof (msg));
+}
+
+void msg_release(msg* m) {
+    if (m == NULL)
+        return;
+
+    outstanding--;
+    pool_slot* p = (pool_slot*) m;
+    if (p >= pool && p < pool + POOL_SIZE)
+        pool_free[pool_top++] = p - pool;
+    else
+        free(m);
+}
+
+int msg_outstanding(void) {
+    return outstanding;
+}
+
+//timeout in millis; the message comes from the pool
+msg* receive_message_timeout(int timeout) {
+    msg* ret = msg_acquire();
+    if (recv_messages(&ret, 1, timeout) != 1) {
+        msg_release(ret);
         return NULL;
     }
     return ret;
 }
 
-int recv_message(msg* ret) {
-    return recvfrom(s, ret, sizeof (msg), 0, NULL, NULL);
+/*
+ * crc16_slice[k][v] is the CRC of byte v followed by k zero bytes, which lets
+ * the table kernel fold eight bytes per step (slice-by-8).
+ */
+static unsigned short crc16_slice[8][256];
+
+static unsigned short crc16_slice8(unsigned short crc, const unsigned char *p, int len) {
+    while (len >= 8) {
+        crc = crc16_slice[7][p[0] ^ (crc >> 8)] ^ crc16_slice[6][p[1] ^ (crc & 0xff)] ^
+              crc16_slice[5][p[2]] ^ crc16_slice[4][p[3]] ^
+              crc16_slice[3][p[4]] ^ crc16_slice[2][p[5]] ^
+              crc16_slice[1][p[6]] ^ crc16_slice[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = (crc << 8) ^ crc16tab[((crc >> 8) ^ *p++) & 0x00FF];
+    return crc;
 }
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
 
-//timeout in millis
-msg* receive_message_timeout(int timeout) {
-    int ret = poll(fds, 1, timeout);
-    if (ret > 0) {
-        if (fds[0].revents & POLLIN)
-            return receive_message();
+/*
+ * x^n mod P for the CCITT polynomial, used as folding constants
+ */
+static unsigned long long crc16_xpow(int n) {
+    unsigned int r = 1;
+    while (n-- > 0) {
+        r <<= 1;
+        if (r & 0x10000)
+            r ^= 0x11021;
+    }
+    return r;
+}
+
+static unsigned long long crc16_k128, crc16_k192, crc16_k512, crc16_k576;
+
+/*
+ * Carry-less multiply kernel: the message is folded 64 bytes at a time into
+ * four 128-bit remainders congruent to it modulo P, which are then reduced
+ * with the table kernel. The CRC state is xored into the first two bytes.
+ */
+__attribute__((target("pclmul,ssse3")))
+static unsigned short crc16_clmul(unsigned short crc, const unsigned char *p, int len) {
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k128 = _mm_set_epi64x(crc16_k192, crc16_k128);
+    const __m128i k512 = _mm_set_epi64x(crc16_k576, crc16_k512);
+    __m128i a[4];
+    unsigned char rem[16];
+    int i;
+
+#define LOAD(q) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (q)), swap)
+#define FOLD(x, k) _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00))
+
+    a[0] = _mm_xor_si128(LOAD(p), _mm_set_epi64x((unsigned long long) crc << 48, 0));
+    if (len >= 128) {
+        for (i = 1; i < 4; i++)
+            a[i] = LOAD(p + 16 * i);
+        p += 64;
+        len -= 64;
+        while (len >= 64) {
+            for (i = 0; i < 4; i++)
+                a[i] = _mm_xor_si128(FOLD(a[i], k512), LOAD(p + 16 * i));
+            p += 64;
+            len -= 64;
+        }
+        for (i = 1; i < 4; i++)
+            a[0] = _mm_xor_si128(FOLD(a[0], k128), a[i]);
+    } else {
+        p += 16;
+        len -= 16;
+    }
+
+    while (len >= 16) {
+        a[0] = _mm_xor_si128(FOLD(a[0], k128), LOAD(p));
+        p += 16;
+        len -= 16;
+    }
+
+#undef FOLD
+#undef LOAD
+
+    _mm_storeu_si128((__m128i *) rem, _mm_shuffle_epi8(a[0], swap));
+    return crc16_slice8(crc16_slice8(0, rem, 16), p, len);
+}
+#endif
+
+//shorter buffers are not worth the setup of the carry-less kernel
+#define CRC16_CLMUL_MIN 64
+
+static unsigned short (*crc16_kernel)(unsigned short, const unsigned char *, int) = crc16_slice8;
+static unsigned short (*crc16_fast)(unsigned short, const unsigned char *, int) = crc16_slice8;
+
+/*
+ * Builds the slice tables and picks the fastest kernel the CPU supports
+ */
+__attribute__((constructor))
+static void crc16_init(void) {
+    int k, v;
+
+    for (v = 0; v < 256; v++)
+        crc16_slice[0][v] = crc16tab[v];
+    for (k = 1; k < 8; k++)
+        for (v = 0; v < 256; v++)
+            crc16_slice[k][v] = (crc16_slice[k - 1][v] << 8) ^
+                                crc16tab[crc16_slice[k - 1][v] >> 8];
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+        crc16_k128 = crc16_xpow(128);
+        crc16_k192 = crc16_xpow(192);
+        crc16_k512 = crc16_xpow(512);
+        crc16_k576 = crc16_xpow(576);
+        crc16_kernel = crc16_fast = crc16_clmul;
     }
-    return NULL;
+#endif
+}
+
+unsigned short crc16_update(unsigned short crc, const void *buf, int len) {
+    if (len >= CRC16_CLMUL_MIN)
+        return crc16_kernel(crc, buf, len);
+    return crc16_slice8(crc, buf, len);
 }
 
 unsigned short crc16_ccitt(const void *buf, int len) {
-    register int counter;
-    register unsigned short crc = 0;
-    for (counter = 0; counter < len; counter++)
-        crc = (crc << 8) ^ crc16tab[((crc >> 8) ^ *(char *) buf++)&0x00FF];
+    return crc16_update(0, buf, len);
+}
+
+/*
+ * CRC32C (Castagnoli polynomial, reflected). crc32c_slice[k][v] is the CRC
+ * of byte v followed by k zero bytes, as for the CRC16 above. The kernels
+ * work on the raw register; the inversions are left to crc32c_update.
+ */
+#define CRC32C_POLY 0x82f63b78
+
+static unsigned int crc32c_slice[8][256];
+
+static unsigned int crc32c_slice8(unsigned int crc, const unsigned char *p, int len) {
+    while (len >= 8) {
+        crc ^= p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+        crc = crc32c_slice[7][crc & 0xff] ^ crc32c_slice[6][(crc >> 8) & 0xff] ^
+              crc32c_slice[5][(crc >> 16) & 0xff] ^ crc32c_slice[4][crc >> 24] ^
+              crc32c_slice[3][p[4]] ^ crc32c_slice[2][p[5]] ^
+              crc32c_slice[1][p[6]] ^ crc32c_slice[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = (crc >> 8) ^ crc32c_slice[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+
+/*
+ * The crc32 instruction has a latency of three cycles and a throughput of
+ * one, so the kernel runs three independent streams over consecutive blocks
+ * of CRC32C_BLOCK bytes. A register is moved past the blocks after it with
+ * crc32c_shift[k], which holds the CRC of each of its bytes followed by
+ * k * CRC32C_BLOCK zero bytes, and the three are xored together.
+ */
+#define CRC32C_BLOCK 128
+
+static unsigned int crc32c_shift[3][4][256];
+
+static inline unsigned int crc32c_skip(const unsigned int t[4][256], unsigned int crc) {
+    return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^
+           t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_sse42(unsigned int crc, const unsigned char *p, int len) {
+    unsigned long long a, b, c, x, y, z;
+    int i;
+
+    while (len >= 3 * CRC32C_BLOCK) {
+        a = crc;
+        b = c = 0;
+        for (i = 0; i < CRC32C_BLOCK; i += 8) {
+            memcpy(&x, p + i, 8);
+            memcpy(&y, p + CRC32C_BLOCK + i, 8);
+            memcpy(&z, p + 2 * CRC32C_BLOCK + i, 8);
+            a = _mm_crc32_u64(a, x);
+            b = _mm_crc32_u64(b, y);
+            c = _mm_crc32_u64(c, z);
+        }
+        crc = crc32c_skip(crc32c_shift[2], a) ^ crc32c_skip(crc32c_shift[1], b) ^ c;
+        p += 3 * CRC32C_BLOCK;
+        len -= 3 * CRC32C_BLOCK;
+    }
+
+    a = crc;
+    while (len >= 8) {
+        memcpy(&x, p, 8);
+        a = _mm_crc32_u64(a, x);
+        p += 8;
+        len -= 8;
+    }
+    crc = a;
+    while (len-- > 0)
+        crc = _mm_crc32_u8(crc, *p++);
     return crc;
-}
\ No newline at end of file
+}
+#endif
+
+static unsigned int (*crc32c_kernel)(unsigned int, const unsigned char *, int) = crc32c_slice8;
+static unsigned int (*crc32c_fast)(unsigned int, const unsigned char *, int) = crc32c_slice8;
+
+/*
+ * Builds the slice and shift tables and picks the fastest kernel the CPU
+ * supports
+ */
+__attribute__((constructor))
+static void crc32c_init(void) {
+    unsigned int c;
+    int k, v, b;
+
+    for (v = 0; v < 256; v++) {
+        c = v;
+        for (b = 0; b < 8; b++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_slice[0][v] = c;
+    }
+    for (k = 1; k < 8; k++)
+        for (v = 0; v < 256; v++)
+            crc32c_slice[k][v] = (crc32c_slice[k - 1][v] >> 8) ^
+                                 crc32c_slice[0][crc32c_slice[k - 1][v] & 0xff];
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        static const unsigned char zero[2 * CRC32C_BLOCK];
+
+        //the shift is linear: every entry is the xor of those of its bits
+        for (k = 1; k < 3; k++)
+            for (b = 0; b < 4; b++) {
+                crc32c_shift[k][b][0] = 0;
+                for (v = 1; v < 256; v++) {
+                    int low = v & -v;
+                    if (v == low)
+                        crc32c_shift[k][b][v] = crc32c_slice8((unsigned int) v << 8 * b,
+                                                              zero, k * CRC32C_BLOCK);
+                    else
+                        crc32c_shift[k][b][v] = crc32c_shift[k][b][low] ^
+                                                crc32c_shift[k][b][v ^ low];
+                }
+            }
+        crc32c_kernel = crc32c_fast = crc32c_sse42;
+    }
+#endif
+}
+
+unsigned int crc32c_update(unsigned int crc, const void *buf, int len) {
+    return ~crc32c_kernel(~crc, buf, len);
+}
+
+unsigned int crc32c(const void *buf, int len) {
+    return crc32c_update(0, buf, len);
+}
+
+/*
+ * Makes both CRCs use the table kernels, whatever the CPU supports, or the
+ * fastest ones again, so that the two can be checked against each other.
+ * Returns which CRCs have a faster kernel than the tables on this CPU: bit
+ * 0 for CRC16, bit 1 for CRC32C.
+ */
+int crc_tables_only(int on) {
+    crc16_kernel = on ? crc16_slice8 : crc16_fast;
+    crc32c_kernel = on ? crc32c_slice8 : crc32c_fast;
+    return (crc16_fast != crc16_slice8) | (crc32c_fast != crc32c_slice8) << 1;
+}
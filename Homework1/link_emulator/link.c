@@ -20,7 +20,8 @@
     
 int BUFFER_SIZE = 1000;
 
-int serialization_delay = 1000;
+//microseconds per bit on the wire, 1000us per full payload by default
+double bit_time = 1000.0 / 11200;
 int delay = 1000;
 int loss = 0;
 int corrupt = 0;
@@ -28,8 +29,10 @@ int corrupt = 0;
 #define CHANNEL_BUSY 1
 #define CHANNEL_IDLE 0
 
-#define LOCAL_PORT1 10000
-#define LOCAL_PORT2 10001
+//ports the sender and the receiver talk to, set apart for each instance
+//when several links run side by side
+int local_port1 = 10000;
+int local_port2 = 10001;
 
 pthread_mutex_t buffer_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t buffer_cond = PTHREAD_COND_INITIALIZER;
@@ -39,11 +42,12 @@ struct sockaddr_in local_addr1, remote_addr1;
 struct sockaddr_in local_addr2, remote_addr2;
 
 int s1, s2;
-socklen_t sz;
 
-//1 if a message was received on this link
+//1 if a message was received on this link; the addresses can change while
+//the other side's thread sends to them
 int link_up1 = 0;
 int link_up2 = 0;
+pthread_mutex_t addr_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #if MITM
 FILE *logfd;
@@ -70,12 +74,12 @@ void init_sockets() {
 
     memset((char *) &local_addr1, 0, sizeof (local_addr1));
     local_addr1.sin_family = AF_INET;
-    local_addr1.sin_port = htons(LOCAL_PORT1);
+    local_addr1.sin_port = htons(local_port1);
     local_addr1.sin_addr.s_addr = htonl(INADDR_ANY);
 
     memset((char *) &local_addr2, 0, sizeof (local_addr2));
     local_addr2.sin_family = AF_INET;
-    local_addr2.sin_port = htons(LOCAL_PORT2);
+    local_addr2.sin_port = htons(local_port2);
     local_addr2.sin_addr.s_addr = htonl(INADDR_ANY);
 
     if ((s1 = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
@@ -100,74 +104,73 @@ void init_sockets() {
     }
 }
 
-int send_message1(const msg* m) {
-    if (!link_up1) {
-        printf("Trying to send a message but remote peer is not connected on my port %d\n", LOCAL_PORT1);
+/*
+ * Stores where the peer on one side of the link is: the first datagram of
+ * a side, or any empty one, teaches it and is not forwarded, so a peer
+ * that restarts or replaces another only has to greet the link again
+ */
+void learn_remote(struct sockaddr_in* remote, int* up, const struct sockaddr_in* from) {
+    pthread_mutex_lock(&addr_lock);
+    *remote = *from;
+    *up = 1;
+    pthread_mutex_unlock(&addr_lock);
+}
+
+int send_to_remote(int s, struct sockaddr_in* remote, int* up, int port, const msg* m) {
+    struct sockaddr_in to;
+    int known;
+
+    pthread_mutex_lock(&addr_lock);
+    to = *remote;
+    known = *up;
+    pthread_mutex_unlock(&addr_lock);
+
+    if (!known) {
+        printf("Trying to send a message but remote peer is not connected on my port %d\n", port);
     }
-    return sendto(s1, m, sizeof (msg), 0, (struct sockaddr*) &remote_addr1, sizeof (remote_addr1));
+    return sendto(s, m->payload, m->len, 0, (struct sockaddr*) &to, sizeof (to));
 }
 
-msg* receive_message1() {
+msg* receive_from(int s, struct sockaddr_in* remote, int* up, int n) {
+    struct sockaddr_in from;
+    socklen_t sz;
     msg* ret;
 
 a:
     ret = (msg*) malloc(sizeof (msg));
+    sz = sizeof (from);
+    if ((ret->len = recvfrom(s, ret->payload, sizeof (ret->payload), 0, (struct sockaddr*) &from, &sz)) == -1) {
+        free(ret);
+        return NULL;
+    }
 
-    if (!link_up1) {
-        sz = sizeof (remote_addr1);
-        if (recvfrom(s1, ret, sizeof (msg), 0, (struct sockaddr*) &remote_addr1, &sz) == -1) {
-            free(ret);
-            return NULL;
-        }
-
-        link_up1 = 1;
+    if (!*up || ret->len == 0) {
+        learn_remote(remote, up, &from);
 
 #if DEBUG
-        printf("Link 1 is up, remote addr is %s port %d\n", inet_ntoa(remote_addr1.sin_addr), ntohs(remote_addr1.sin_port));
+        printf("Link %d is up, remote addr is %s port %d\n", n, inet_ntoa(from.sin_addr), ntohs(from.sin_port));
 #endif
 
         free(ret);
         goto a;
-    } else if (recvfrom(s1, ret, sizeof (msg), 0, NULL, NULL) == -1) {
-        free(ret);
-        return NULL;
     }
     return ret;
 }
 
-int send_message2(const msg* m) {
-    if (!link_up2) {
-        printf("Trying to send a message but remote peer is not connected on my port %d\n", LOCAL_PORT2);
-    }
-    return sendto(s2, m, sizeof (msg), 0, (struct sockaddr*) &remote_addr2, sizeof (remote_addr2));
+int send_message1(const msg* m) {
+    return send_to_remote(s1, &remote_addr1, &link_up1, local_port1, m);
 }
 
-msg* receive_message2() {
-    msg* ret;
-
-a:
-    ret = (msg*) malloc(sizeof (msg));
-    if (!link_up2) {
-        sz = sizeof (remote_addr2);
-        if (recvfrom(s2, ret, sizeof (msg), 0, (struct sockaddr*) &remote_addr2, &sz) == -1) {
-            free(ret);
-            return NULL;
-        }
-        link_up2 = 1;
-
-#if DEBUG
-        printf("Link 2 is up, remote addr is %s port %d\n", inet_ntoa(remote_addr2.sin_addr), ntohs(remote_addr2.sin_port));
-#endif
+msg* receive_message1() {
+    return receive_from(s1, &remote_addr1, &link_up1, 1);
+}
 
-        free(ret);
-        goto a;
-    } else
-        if (recvfrom(s2, ret, sizeof (msg), 0, NULL, NULL) == -1) {
-        free(ret);
-        return NULL;
-    }
+int send_message2(const msg* m) {
+    return send_to_remote(s2, &remote_addr2, &link_up2, local_port2, m);
+}
 
-    return ret;
+msg* receive_message2() {
+    return receive_from(s2, &remote_addr2, &link_up2, 2);
 }
 
 unsigned long long now() {
@@ -231,8 +234,6 @@ void* link_scheduler(void *argument) {
 
         //now see if we can put stuff in flight
         if (stuff && crt_time >= idle_time) {
-            idle_time = crt_time + serialization_delay;
-
             mif = (msg_in_flight*) malloc(sizeof (msg_in_flight));
             assert(mif);
 
@@ -241,6 +242,10 @@ void* link_scheduler(void *argument) {
             pthread_mutex_unlock(&buffer_lock);
 
             assert(mif->m);
+
+            //the wire is busy for as long as the actual datagram takes
+            long long serialization_delay = bit_time * 8 * mif->m->len;
+            idle_time = crt_time + serialization_delay;
             mif->finish_time = crt_time + serialization_delay + delay;
 
             //send message here from buffer to link
@@ -301,7 +306,7 @@ void* run_forwarding(void* param) {
             printf("Dropped packet\n");
         }
         else {
-            if (rand() % 100 < corrupt) {
+            if (m->len > 0 && rand() % 100 < corrupt) {
                 m->payload[rand() % m->len] = rand() % 128;
             }
             //printf("Enqueue 1.");
@@ -335,6 +340,8 @@ void* run_reverse_forwarding(void* param) {
 #define DELAY 2
 #define LOSS 3
 #define CORRUPT 4
+#define PORT1 5
+#define PORT2 6
 
 int split_param(char* p, int * type, double* value) {
     char c[100];
@@ -354,6 +361,10 @@ int split_param(char* p, int * type, double* value) {
                 *type = LOSS;
             else if (!strcasecmp(c, "corrupt"))
                 *type = CORRUPT;
+            else if (!strcasecmp(c, "port1"))
+                *type = PORT1;
+            else if (!strcasecmp(c, "port2"))
+                *type = PORT2;
             else {
                 printf("Unknown parameter %s\n", c);
                 return -1;
@@ -401,14 +412,14 @@ int main(int argc, char** argv) {
         int type;
         double value;
         if (split_param(argv[i], &type, &value) < 0) {
-            printf("Usage %s speed=[speed in mb/s] delay=[delay in ms] loss=[percent of packets] corrupt=[percent of packets]\n", argv[0]);
+            printf("Usage %s speed=[speed in mb/s] delay=[delay in ms] loss=[percent of packets] corrupt=[percent of packets] port1=[sender port] port2=[receiver port]\n", argv[0]);
             return -1;
         }
 
         switch (type) {
             case SPEED:
                 printf("Setting speed to %f Mb/s\n", value);
-                serialization_delay = 2 * 11200 / value;
+                bit_time = 2 / value;
                 break;
             case DELAY:
                 printf("Setting delay %f to ms\n", value);
@@ -422,6 +433,14 @@ int main(int argc, char** argv) {
                 printf("Setting corruption rate to %f%%\n", value);
                 corrupt = value;
                 break;
+            case PORT1:
+                printf("Setting sender port to %d\n", (int) value);
+                local_port1 = value;
+                break;
+            case PORT2:
+                printf("Setting receiver port to %d\n", (int) value);
+                local_port2 = value;
+                break;
         }
     }
 
@@ -441,7 +460,8 @@ int main(int argc, char** argv) {
 #if MITM
     srand(LOG_SEED);
 #else    
-    srand(time(NULL));
+    //links started together must not lose the same packets
+    srand(time(NULL) ^ getpid());
 #endif
     
     buffer = create_queue();
@@ -0,0 +1,146 @@
+#!/bin/bash
+#
+# Goodput benchmark: sweeps the link parameters and the file size, running
+# TRIALS transfers of a generated file for every combination.
+# Every trial is a line of $OUT.csv, its counters taken from the final
+# KERMIT_STATS line of each side; $OUT.json holds the mean of each metric
+# per configuration with its 95% confidence interval. Failed trials, whose
+# copy differs or which timed out, are left out of the statistics and only
+# counted.
+#
+# Any of the lists below can be overridden from the environment, e.g.
+#   SPEEDS="10 50" LOSSES="0 5" TRIALS=10 SENDER_ARGS="-w 31" ./run_benchmark.sh
+
+SPEEDS=(${SPEEDS:-10})
+DELAYS=(${DELAYS:-10})
+LOSSES=(${LOSSES:-0 5})
+CORRUPTS=(${CORRUPTS:-0 20})
+SIZES=(${SIZES:-10000 1000000})
+TRIALS=${TRIALS:-5}
+SENDER_ARGS=${SENDER_ARGS:-}
+RUN_TIMEOUT=${RUN_TIMEOUT:-300}
+OUT=${OUT:-benchmark}
+
+killall link kreceiver ksender &> /dev/null
+
+# Counter $2 of the last statistics line in file $1, 0 if there is none
+stat_of() {
+	tail -n 1 "$1" 2> /dev/null | grep -o "\"$2\": [0-9]*" | grep -o "[0-9]*$" ||
+		echo 0
+}
+
+echo "speed,delay,loss,corrupt,size,trial,ok,time,goodput,retransmissions,timeouts,naks,crc_failures" > $OUT.csv
+
+for SIZE in "${SIZES[@]}"
+do
+	FILE=bench_$SIZE.bin
+	head -c $SIZE /dev/urandom > $FILE
+
+	for SPEED in "${SPEEDS[@]}"
+	do
+	for DELAY in "${DELAYS[@]}"
+	do
+	for LOSS in "${LOSSES[@]}"
+	do
+	for CORRUPT in "${CORRUPTS[@]}"
+	do
+	for TRIAL in $(seq 1 $TRIALS)
+	do
+		rm -f recv_$FILE $OUT.sender.json $OUT.receiver.json
+		./link_emulator/link speed=$SPEED delay=$DELAY loss=$LOSS corrupt=$CORRUPT &> /dev/null &
+		sleep 0.3
+		KERMIT_STATS=$OUT.receiver.json timeout $RUN_TIMEOUT ./kreceiver > $OUT.receiver.log &
+		RECEIVER=$!
+		sleep 0.3
+
+		START=$(date +%s.%N)
+		KERMIT_STATS=$OUT.sender.json timeout $RUN_TIMEOUT ./ksender $SENDER_ARGS $FILE > $OUT.sender.log
+		END=$(date +%s.%N)
+		wait $RECEIVER
+		killall link &> /dev/null
+		wait
+
+		OK=0
+		cmp -s $FILE recv_$FILE && OK=1
+		RETRANSMITS=$(stat_of $OUT.sender.json retransmits)
+		TIMEOUTS=$(stat_of $OUT.sender.json timeouts)
+		NAKS=$(stat_of $OUT.sender.json naks)
+		CRC=$(stat_of $OUT.receiver.json crc_failures)
+
+		awk -v s=$START -v e=$END -v ok=$OK -v size=$SIZE -v r=$RETRANSMITS \
+		    -v t=$TIMEOUTS -v n=$NAKS -v c=$CRC \
+		    -v cfg="$SPEED,$DELAY,$LOSS,$CORRUPT,$SIZE,$TRIAL" 'BEGIN {
+			time = e - s
+			printf "%s,%d,%.4f,%.1f,%d,%d,%d,%d\n", cfg, ok, time,
+			       ok ? size / time : 0, r, t, n, c
+		}' >> $OUT.csv
+		tail -n 1 $OUT.csv
+	done
+	done
+	done
+	done
+	done
+
+	rm -f $FILE recv_$FILE
+done
+
+rm -f $OUT.sender.log $OUT.receiver.log $OUT.sender.json $OUT.receiver.json
+
+# Mean, standard deviation and 95% confidence interval (Student's t) of every
+# metric, over the successful trials of each configuration
+awk -F, '
+function t95(df) {
+	split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+	      "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 " \
+	      "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042", q, " ")
+	return df <= 30 ? q[df] : 1.96
+}
+NR == 1 {
+	for (i = 8; i <= NF; ++i)
+		name[i] = $i
+	last = NF
+	next
+}
+{
+	key = $1 "," $2 "," $3 "," $4 "," $5
+	if (!(key in n))
+		keys[++nkeys] = key
+	n[key]++
+	if ($7 == 0) {
+		failed[key]++
+		next
+	}
+	good[key]++
+	for (i = 8; i <= NF; ++i) {
+		sum[key, i] += $i
+		sq[key, i] += $i * $i
+	}
+}
+END {
+	print "["
+	for (k = 1; k <= nkeys; ++k) {
+		key = keys[k]
+		split(key, c, ",")
+		m = good[key]
+		printf "  {\"speed\": %s, \"delay\": %s, \"loss\": %s, \"corrupt\": %s, \"size\": %s, \"trials\": %d, \"failed\": %d",
+		       c[1], c[2], c[3], c[4], c[5], n[key], failed[key]
+		for (i = 8; i <= last; ++i) {
+			if (m == 0) {
+				printf ", \"%s\": null", name[i]
+				continue
+			}
+			mean = sum[key, i] / m
+			var = m > 1 ? (sq[key, i] - m * mean * mean) / (m - 1) : 0
+			sd = var > 0 ? sqrt(var) : 0
+			ci = m > 1 ? t95(m - 1) * sd / sqrt(m) : 0
+			printf ", \"%s\": {\"mean\": %.4f, \"stddev\": %.4f, \"ci95\": %.4f}",
+			       name[i], mean, sd, ci
+		}
+		printf "}%s\n", k < nkeys ? "," : ""
+	}
+	print "]"
+}' $OUT.csv > $OUT.json
+
+echo "==========================="
+echo "Results written to $OUT.csv and $OUT.json"
+echo "==========================="
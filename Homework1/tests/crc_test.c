@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib.h"
+
+/*
+ * Self-test of the CRC kernels: the carry-less multiply CRC16 and the SSE4.2
+ * CRC32C, where the CPU has them, must agree with the table kernels and
+ * with a bit-at-a-time reference on random lengths and alignments, whole
+ * or continued over two pieces.
+ */
+
+#define TRIALS 20000
+#define MAX_LEN 4096
+#define MAX_ALIGN 16
+
+static unsigned short ref_crc16(const unsigned char* p, int len)
+{
+	unsigned short crc = 0;
+
+	while (len-- > 0) {
+		crc ^= *p++ << 8;
+		for (int b = 0; b < 8; ++b)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static unsigned int ref_crc32c(const unsigned char* p, int len)
+{
+	unsigned int crc = ~0u;
+
+	while (len-- > 0) {
+		crc ^= *p++;
+		for (int b = 0; b < 8; ++b)
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+	}
+	return ~crc;
+}
+
+/*
+ * Function that checks one buffer, split at cut. Returns the number of
+ * mismatches, which it reports.
+ */
+static int check(const unsigned char* p, int len, int cut)
+{
+	unsigned short crc16[2];
+	unsigned int crc32[2];
+
+	for (int tables = 0; tables < 2; ++tables) {
+		crc_tables_only(tables);
+		crc16[tables] = crc16_update(crc16_update(0, p, cut),
+					     p + cut, len - cut);
+		crc32[tables] = crc32c_update(crc32c_update(0, p, cut),
+					      p + cut, len - cut);
+	}
+	crc_tables_only(0);
+
+	unsigned short want16 = ref_crc16(p, len);
+	unsigned int want32 = ref_crc32c(p, len);
+	int bad = 0;
+	if (crc16[0] != want16 || crc16[1] != want16) {
+		printf("CRC16 len %d align %d cut %d: fast %04x tables %04x"
+		       " reference %04x\n", len, (int) ((long) p % MAX_ALIGN),
+		       cut, crc16[0], crc16[1], want16);
+		bad++;
+	}
+	if (crc32[0] != want32 || crc32[1] != want32) {
+		printf("CRC32C len %d align %d cut %d: fast %08x tables %08x"
+		       " reference %08x\n", len, (int) ((long) p % MAX_ALIGN),
+		       cut, crc32[0], crc32[1], want32);
+		bad++;
+	}
+	return bad;
+}
+
+int main(int argc, char** argv)
+{
+	static unsigned char buf[MAX_LEN + MAX_ALIGN] __attribute__((aligned(64)));
+	//lengths around the thresholds and block sizes of the kernels
+	static const int edges[] = { 0, 1, 7, 8, 9, 15, 16, 17, 63, 64, 65,
+				     127, 128, 129, 383, 384, 385, 767, 768,
+				     1024, 1400, MAX_LEN };
+	unsigned int seed = argc > 1 ? atoi(argv[1]) : 1;
+	int bad = 0;
+
+	srand(seed);
+	for (int i = 0; i < (int) sizeof(buf); ++i)
+		buf[i] = rand();
+
+	int fast = crc_tables_only(0);
+	printf("CRC16 %s, CRC32C %s, seed %u\n",
+	       fast & 1 ? "carry-less multiply" : "tables only",
+	       fast & 2 ? "SSE4.2" : "tables only", seed);
+
+	if (crc16_ccitt("123456789", 9) != 0x31c3 ||
+	    crc32c("123456789", 9) != 0xe3069283) {
+		printf("check values of \"123456789\" differ\n");
+		bad++;
+	}
+	for (int i = 0; i < (int) (sizeof(edges) / sizeof(edges[0])); ++i)
+		for (int align = 0; align < MAX_ALIGN; ++align)
+			bad += check(buf + align, edges[i], edges[i] / 2);
+	for (int i = 0; i < TRIALS; ++i) {
+		int len = rand() % (MAX_LEN + 1);
+		bad += check(buf + rand() % MAX_ALIGN, len, rand() % (len + 1));
+	}
+
+	printf("%s\n", bad ? "FAILED" : "OK");
+	return bad != 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../kfec.h"
+
+/*
+ * Self-test of the Reed-Solomon codec of kfec.c: blocks of random packets
+ * are encoded, some packets and some parity packets are erased, and the
+ * packets rebuilt from what is left must be the erased ones, zero padded.
+ * More erasures than parity packets left must be refused. The seed is
+ * fixed, so every run checks the same blocks.
+ */
+
+#define TRIALS 2000
+#define MAX_DATA 1000
+#define SYMBOL (FEC_HEADER + MAX_DATA)
+
+static unsigned char packet[FEC_MAX_N][SYMBOL];
+static unsigned char rebuilt[FEC_MAX_N][SYMBOL];
+static fec_encoder enc;
+
+/*
+ * Function that picks count distinct numbers below n into pick, in order
+ */
+static void pick_distinct(int* pick, int count, int n)
+{
+	char taken[FEC_MAX_N];
+
+	memset(taken, 0, sizeof(taken));
+	for (int c = 0; c < count; ++c) {
+		int i;
+		do
+			i = rand() % n;
+		while (taken[i]);
+		taken[i] = 1;
+	}
+	for (int i = 0, c = 0; i < n; ++i)
+		if (taken[i])
+			pick[c++] = i;
+}
+
+/*
+ * Function that encodes a block of n packets with k parity packets, erases
+ * lost packets and keeps nrows parity packets. Returns 1 if the outcome is
+ * the expected one.
+ */
+static int check(int n, int k, int lost, int nrows)
+{
+	unsigned char *sym[FEC_MAX_N], *out[FEC_MAX_N], *parity[FEC_MAX_K];
+	int sym_len[FEC_MAX_N], erased[FEC_MAX_N], rows[FEC_MAX_K];
+
+	fec_reset(&enc, 0, k, SYMBOL);
+	for (int i = 0; i < n; ++i) {
+		int len = rand() % (MAX_DATA + 1);
+		packet[i][0] = 'D';
+		packet[i][1] = len >> 8;
+		packet[i][2] = len & 0xff;
+		for (int b = 0; b < len; ++b)
+			packet[i][FEC_HEADER + b] = rand();
+		memset(packet[i] + FEC_HEADER + len, 0, MAX_DATA - len);
+		fec_add(&enc, 'D', packet[i] + FEC_HEADER, len);
+		sym[i] = packet[i];
+		sym_len[i] = FEC_HEADER + len;
+		out[i] = rebuilt[i];
+	}
+
+	pick_distinct(erased, lost, n);
+	for (int e = 0; e < lost; ++e) {
+		sym[erased[e]] = NULL;
+		memset(rebuilt[erased[e]], 0xa5, SYMBOL);
+	}
+	pick_distinct(rows, nrows, k);
+	for (int t = 0; t < nrows; ++t)
+		parity[t] = enc.parity[rows[t]];
+
+	int got = fec_recover(n, sym, sym_len, nrows, rows, parity, SYMBOL,
+			      out);
+	if (lost > nrows)
+		return got == -1;
+	if (got != lost)
+		return 0;
+	for (int e = 0; e < lost; ++e)
+		if (memcmp(rebuilt[erased[e]], packet[erased[e]], SYMBOL) != 0)
+			return 0;
+	return 1;
+}
+
+int main()
+{
+	int bad = 0;
+
+	srand(1);
+	//every erasure count a block can repair, and one more
+	for (int k = 1; k <= FEC_MAX_K; ++k)
+		for (int lost = 0; lost <= k + 1; ++lost)
+			if (!check(FEC_MAX_N, k, lost, k)) {
+				printf("n %d k %d lost %d: wrong\n", FEC_MAX_N,
+				       k, lost);
+				bad++;
+			}
+	for (int i = 0; i < TRIALS; ++i) {
+		int n = 1 + rand() % FEC_MAX_N;
+		int k = 1 + rand() % FEC_MAX_K;
+		int nrows = rand() % (k + 1);
+		int lost = rand() % ((nrows + 1 < n ? nrows + 1 : n) + 1);
+		if (!check(n, k, lost, nrows)) {
+			printf("n %d k %d lost %d parity %d: wrong\n", n, k,
+			       lost, nrows);
+			bad++;
+		}
+	}
+
+	printf("%s\n", bad ? "FAILED" : "OK");
+	return bad != 0;
+}